@@ -7,15 +7,23 @@ use std::iter;
 use crate::dict::{Attr, Dict, Entry, Input};
 use crate::freemap::FreeMap;
 use crate::orthography;
+use crate::regex_ortho;
 use crate::stroke::{hash_strokes, Strokes};
+use crate::suffix_filter::SuffixFilter;
+use crate::word_list;
 
 /// Byte level counterpart for `Entry`, is just a wrapper around the actual bytes that would be written to the
 /// keyboard storage.
 pub struct RawEntry(Vec<u8>);
 
+/// Command byte before a run of text and its length, in entries that aren't only plain text
+const TEXT_RUN: u8 = 6;
+
 impl From<Entry> for RawEntry {
     fn from(e: Entry) -> RawEntry {
-        let attr: RawAttr = e.attr.into();
+        let mut attr: RawAttr = e.attr.into();
+        let plain_text = e.is_plain_text();
+        attr.set_text(plain_text.into());
         let bytes = iter::once(attr.0)
             .chain(e.inputs.iter().flat_map(|i| match i {
                 Input::Keycodes(keycodes) => {
@@ -28,6 +36,11 @@ impl From<Entry> for RawEntry {
                         bytes
                     }
                 }
+                Input::String(s) if !plain_text && i.is_text_run() => {
+                    let mut bytes = vec![TEXT_RUN, s.len() as u8];
+                    bytes.extend(s.as_bytes());
+                    bytes
+                }
                 Input::String(s) => s.as_bytes().to_vec(),
                 Input::Carry(s) => {
                     let mut bytes = s.as_bytes().to_vec();
@@ -68,6 +81,8 @@ bitfield! {
     space_after, set_space_after: 1, 1;
     glue, set_glue: 2, 2;
     present, set_present: 3, 3;
+    // Only plain text, see `Entry::is_plain_text`
+    text, set_text: 4, 4;
 }
 
 impl From<Attr> for RawAttr {
@@ -81,10 +96,32 @@ impl From<Attr> for RawAttr {
     }
 }
 
+/// Buckets are 6 bytes: the entry length, value block offset and stroke count (or an inline entry, see `inline_word`)
+/// in a word, then the upper 12 bits of the
+/// hash (to tell apart colliding buckets without reading the value block) and the inverted displacement from the bucket
+/// the hash points to, in 4 bits
+const BUCKET_NUM: usize = 0x80000;
+/// Buckets are laid out Robin Hood style, and no entry is further than this from its home bucket, so that a search
+/// (including one for strokes not in the dictionary) never reads more than `MAX_DISPLACEMENT + 1` buckets
+const MAX_DISPLACEMENT: usize = 8;
+
 #[allow(dead_code)]
 pub const KVPAIR_START: usize = 0x400000;
 #[allow(dead_code)]
+pub const SUFFIX_FILTER_START: usize = 0xE00000;
+#[allow(dead_code)]
+pub const ENDING_LENS_START: usize = 0xE80000;
+/// The word list to check the orthography against, in the space after the entry lengths table
+pub const WORDS_START: usize = 0xEA0000;
+#[allow(dead_code)]
 pub const FREEMAP_START: usize = 0xF00000;
+
+/// Entries in the table of entry lengths, indexed by the upper 16 bits of the hash of the last stroke
+const ENDING_LENS_NUM: usize = 0x10000;
+/// Cleared in the entry lengths table for strokes in the middle of a multi-stroke entry
+const ENDING_LENS_MIDDLE_BIT: usize = 14;
+/// Cleared in the entry lengths table for strokes that start a multi-stroke entry
+const ENDING_LENS_PREFIX_BIT: usize = 15;
 #[allow(dead_code)]
 pub const SCRATCH_START: usize = 0xF22000;
 #[allow(dead_code)]
@@ -94,6 +131,7 @@ pub const ORTHOGRAPHY_START: usize = 0xF30000;
 pub enum CompileError {
     TooManyStrokes(Strokes),
     LargeEntry(Strokes),
+    LongProbe(Strokes),
     NoStorage { cur_len: usize, total: usize },
     Io(std::io::Error),
 }
@@ -104,6 +142,11 @@ impl std::fmt::Display for CompileError {
         match self {
             TooManyStrokes(s) => write!(f, "The entry '{}' has too many (>14) strokes", s),
             LargeEntry(s) => write!(f, "The entry mapped from '{}' is too large", s),
+            LongProbe(s) => write!(
+                f,
+                "The entry '{}' would be more than {} buckets away from its hash",
+                s, MAX_DISPLACEMENT
+            ),
             NoStorage { cur_len, total } => write!(
                 f,
                 "Storage space runs out for entries. Entries stored {}/{}",
@@ -114,31 +157,156 @@ impl std::fmt::Display for CompileError {
     }
 }
 
-pub fn to_writer(d: Dict, w: &mut dyn Write) -> Result<(), CompileError> {
+/// Single stroke entries of at most `INLINE_LEN` bytes, all of them 7-bit and non-zero, are kept in the bucket itself
+/// instead of a value block. The stroke count stays 1 and the top nibble of the block offset (past the end of the
+/// value blocks) is set to mark them; the other 24 bits have the attributes in the lowest 3, then the bytes 7 bits each,
+/// padded with zeros. The strokes aren't kept, as the hash bits from the bucket index and the fingerprint are distinct
+/// for every stroke.
+const INLINE_LEN: usize = 3;
+const INLINE_MARK: u32 = 0xF00000;
+
+fn inline_word(raw_entry: &RawEntry) -> Option<u32> {
+    let (attr, bytes) = raw_entry.as_bytes().split_first().unwrap();
+    if bytes.len() > INLINE_LEN || bytes.iter().any(|&b| b == 0 || b >= 0x80) {
+        return None;
+    }
+    let payload = bytes
+        .iter()
+        .enumerate()
+        .fold((attr & 0x07) as u32, |p, (i, &b)| p | (b as u32) << (3 + 7 * i));
+    Some((payload >> 16) << 24 | INLINE_MARK | (payload & 0xFFFF) << 4 | 1)
+}
+
+#[derive(Clone, Copy)]
+struct Bucket {
+    hash: u32,
+    word: u32,
+    displacement: usize,
+}
+
+impl Bucket {
+    fn as_bytes(&self) -> [u8; 6] {
+        let mut bytes = [0xFF; 6];
+        bytes[..4].copy_from_slice(&self.word.to_le_bytes());
+        let tail = (self.hash >> 20) << 4 | (0xF ^ self.displacement as u32);
+        bytes[4..].copy_from_slice(&(tail as u16).to_le_bytes());
+        bytes
+    }
+}
+
+/// Open addressing with Robin Hood insertion: an entry takes the bucket of one closer to its home bucket, which moves
+/// on in its place, so the displacements stay short and even
+struct Buckets(Vec<Option<Bucket>>);
+
+impl Buckets {
+    fn new() -> Self {
+        Buckets(vec![None; BUCKET_NUM])
+    }
+
+    /// Returns false if some entry ends up more than `MAX_DISPLACEMENT` away from its home bucket
+    fn insert(&mut self, mut bucket: Bucket) -> bool {
+        let mut index = (bucket.hash as usize + bucket.displacement) % BUCKET_NUM;
+        loop {
+            if bucket.displacement > MAX_DISPLACEMENT {
+                return false;
+            }
+            match &mut self.0[index] {
+                None => {
+                    self.0[index] = Some(bucket);
+                    return true;
+                }
+                Some(b) if b.displacement < bucket.displacement => std::mem::swap(b, &mut bucket),
+                Some(_) => {}
+            }
+            index = (index + 1) % BUCKET_NUM;
+            bucket.displacement += 1;
+        }
+    }
+
+    fn write(&self, file: &mut Uf2File) {
+        for bucket in &self.0 {
+            file.write_all(&bucket.map_or([0xFF; 6], |b| b.as_bytes()));
+        }
+    }
+}
+
+impl std::fmt::Display for Buckets {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        let mut displacements = [0usize; MAX_DISPLACEMENT + 1];
+        let mut inline = 0;
+        for b in self.0.iter().flatten() {
+            displacements[b.displacement] += 1;
+            if b.word & 0xF0000F == INLINE_MARK | 1 {
+                inline += 1;
+            }
+        }
+        let total: usize = displacements.iter().sum();
+        let sum: usize = displacements.iter().enumerate().map(|(d, n)| d * n).sum();
+        write!(
+            f,
+            "Buckets: {}/{} used ({} inline), mean displacement {:.3}, by displacement {:?}",
+            total,
+            BUCKET_NUM,
+            inline,
+            sum as f64 / total.max(1) as f64,
+            displacements
+        )
+    }
+}
+
+/// With `usage` (see `workload::usage_counts`), the most used entries are laid out first, so that they're at the
+/// head of their probe chains and their value blocks are packed together
+pub fn to_writer(
+    d: Dict,
+    usage: Option<&BTreeMap<Strokes, u32>>,
+    words: &[String],
+    w: &mut dyn Write,
+) -> Result<(), CompileError> {
     let mut file = Uf2File::new();
     // Buffering buckets so less book keeping
-    // 1M entries of 4 bytes; key length cannot be 15
-    let mut buckets = vec![0xFFFFFFFF; 2usize.pow(20)];
-    let mut map = FreeMap::new((FREEMAP_START - KVPAIR_START) as u32);
-    let mut collisions = BTreeMap::new();
+    let mut buckets = Buckets::new();
+    // Sized in 16 byte blocks
+    let mut map = FreeMap::new(((SUFFIX_FILTER_START - KVPAIR_START) / 16) as u32);
+    let mut filter = SuffixFilter::new();
+    // Stroke counts of the entries ending in a stroke, with bit `n - 1` cleared for `n` strokes so that the firmware
+    // can add to it without erasing. `ENDING_LENS_PREFIX_BIT` is also cleared if the stroke starts a longer entry,
+    // and `ENDING_LENS_MIDDLE_BIT` if it's in the middle of one
+    let mut ending_lens = vec![0xFFFFu16; ENDING_LENS_NUM];
     let total_len = d.0.len();
-    for (i, (strokes, entry)) in d.0.into_iter().enumerate() {
+    let mut entries: Vec<_> = d.0.into_iter().collect();
+    if let Some(usage) = usage {
+        entries.sort_by_key(|(strokes, _)| std::cmp::Reverse(usage.get(strokes).copied().unwrap_or(0)));
+    }
+    for (i, (strokes, entry)) in entries.into_iter().enumerate() {
         if strokes.len() > 14 {
             return Err(CompileError::TooManyStrokes(strokes));
         }
-        let hash = hash_strokes(&strokes);
-        let mut index = hash as usize % 2usize.pow(20);
-        let mut collision = 0;
-        while buckets[index] != 0xFFFFFFFF {
-            index = (index + 1) % 2usize.pow(20);
-            collision += 1;
+        filter.add(&strokes);
+        let last_stroke = strokes.0[strokes.len() - 1];
+        ending_lens[(last_stroke.hash(None) >> 16) as usize] &= !(1 << (strokes.len() - 1));
+        if strokes.len() > 1 {
+            ending_lens[(strokes.0[0].hash(None) >> 16) as usize] &= !(1 << ENDING_LENS_PREFIX_BIT);
+        }
+        for stroke in strokes.0.iter().take(strokes.len().saturating_sub(1)).skip(1) {
+            ending_lens[(stroke.hash(None) >> 16) as usize] &= !(1 << ENDING_LENS_MIDDLE_BIT);
         }
-        collisions
-            .entry(collision)
-            .and_modify(|c| *c += 1)
-            .or_insert(1);
+        let hash = hash_strokes(&strokes);
         let entry_len = entry.byte_len();
         assert!(entry_len < 256);
+        let raw_entry: RawEntry = entry.into();
+        if strokes.len() == 1 {
+            if let Some(word) = inline_word(&raw_entry) {
+                let bucket = Bucket {
+                    hash,
+                    word,
+                    displacement: 0,
+                };
+                if !buckets.insert(bucket) {
+                    return Err(CompileError::LongProbe(strokes));
+                }
+                continue;
+            }
+        }
         let pair_size = strokes.len() * 3 + 1 + entry_len;
         let block_no = if pair_size <= 16 {
             map.req(0)
@@ -156,26 +324,60 @@ pub fn to_writer(d: Dict, w: &mut dyn Write) -> Result<(), CompileError> {
             cur_len: i,
             total: total_len,
         })? << 4;
-        buckets[index] = (entry_len as u32) << 24 | block_offset | strokes.len() as u32;
+        let bucket = Bucket {
+            hash,
+            word: (entry_len as u32) << 24 | block_offset | strokes.len() as u32,
+            displacement: 0,
+        };
+        if !buckets.insert(bucket) {
+            return Err(CompileError::LongProbe(strokes));
+        }
         file.seek(KVPAIR_START + block_offset as usize);
         for stroke in strokes.0 {
             file.write_all(&stroke.raw().to_le_bytes()[0..3]);
         }
-        let raw_entry: RawEntry = entry.into();
         file.write_all(&raw_entry.as_bytes());
     }
 
-    dbg!(collisions);
+    println!("{}", buckets);
     file.seek(0);
-    for bucket in buckets {
-        file.write_all(&bucket.to_le_bytes());
+    buckets.write(&mut file);
+    println!("{}", filter);
+    file.seek(SUFFIX_FILTER_START);
+    file.write_all(filter.as_bytes());
+    let single = ending_lens.iter().filter(|&&l| l == 0xFFFE).count();
+    let used = ending_lens.iter().filter(|&&l| l != 0xFFFF).count();
+    let prefix = ending_lens
+        .iter()
+        .filter(|&&l| l & (1 << ENDING_LENS_PREFIX_BIT) == 0)
+        .count();
+    let middle = ending_lens
+        .iter()
+        .filter(|&&l| l & (1 << ENDING_LENS_MIDDLE_BIT) == 0)
+        .count();
+    println!(
+        "Entry lengths table: {} of {} slots used, {} with only single stroke entries, {} starting longer entries, {} in the middle of one",
+        used, ENDING_LENS_NUM, single, prefix, middle
+    );
+    file.seek(ENDING_LENS_START);
+    for lens in ending_lens {
+        file.write_all(&lens.to_le_bytes());
     }
     file.seek(FREEMAP_START);
     for word in map.map {
         file.write_all(&word.to_le_bytes());
     }
     file.seek(ORTHOGRAPHY_START);
-    file.write_all(&orthography::generate());
+    let simple = orthography::generate();
+    assert!(simple.len() <= regex_ortho::REGEX_START);
+    file.write_all(&simple);
+    file.seek(ORTHOGRAPHY_START + regex_ortho::REGEX_START);
+    file.write_all(&regex_ortho::generate());
+    let words = word_list::generate(words);
+    if !words.is_empty() {
+        file.seek(WORDS_START);
+        file.write_all(&words);
+    }
     file.write_to(w).map_err(CompileError::Io)
 }
 
@@ -284,3 +486,66 @@ impl From<RawAttr> for Attr {
         }
     }
 }
+
+#[test]
+fn test_buckets() {
+    let bucket = |hash| Bucket {
+        hash,
+        word: 0,
+        displacement: 0,
+    };
+    let mut buckets = Buckets::new();
+    assert!(buckets.insert(bucket(2)));
+    assert!(buckets.insert(bucket(1)));
+    // Takes the place of the entry already in its home bucket, which moves on
+    assert!(buckets.insert(bucket(1)));
+    let displacements: Vec<_> = buckets.0[1..4].iter().map(|b| b.unwrap().displacement).collect();
+    assert_eq!(displacements, [0, 1, 1]);
+    assert_eq!(buckets.0[3].unwrap().hash, 2);
+    assert_eq!(buckets.0[3].unwrap().as_bytes()[4] & 0xF, 0xF ^ 1);
+    for _ in 0..MAX_DISPLACEMENT - 1 {
+        assert!(buckets.insert(bucket(1)));
+    }
+    assert!(!buckets.insert(bucket(1)));
+}
+
+#[test]
+fn test_inline_word() {
+    let entry = |s: &str| -> RawEntry {
+        Entry {
+            inputs: vec![Input::String(s.to_string())],
+            ..Entry::default()
+        }
+        .into()
+    };
+    let word = inline_word(&entry("the")).unwrap();
+    assert_eq!(word & 0xF0000F, INLINE_MARK | 1);
+    let payload = (word >> 4) & 0xFFFF | (word >> 24) << 16;
+    let bytes: Vec<u8> = (0..3).map(|i| (payload >> (3 + 7 * i)) as u8 & 0x7F).collect();
+    assert_eq!(bytes, b"the");
+    assert_eq!(payload & 0x07, entry("the").as_bytes()[0] as u32 & 0x07);
+    assert!(inline_word(&entry("to")).is_some());
+    assert!(inline_word(&entry("they")).is_none());
+    assert!(inline_word(&entry("né")).is_none());
+}
+
+#[test]
+fn test_text_runs() {
+    let raw = |s: &str| -> Vec<u8> {
+        let entry = Entry::parse_entry(s).unwrap();
+        let len = entry.byte_len();
+        let raw: RawEntry = entry.into();
+        assert_eq!(raw.as_bytes().len(), len + 1);
+        raw.as_bytes().to_vec()
+    };
+    let text = |b: u8| RawAttr(b).text() != 0;
+    let plain = raw("hello world");
+    assert!(text(plain[0]));
+    assert_eq!(&plain[1..], b"hello world");
+    // Text among commands is prefixed with its length, unless it's too short for that to pay off
+    let mixed = raw("Mr.{-|}");
+    assert!(!text(mixed[0]));
+    assert_eq!(&mixed[1..], &[TEXT_RUN, 3, b'M', b'r', b'.', 3]);
+    assert_eq!(&raw("{.}")[1..], &[b'.', 3]);
+    assert!(!text(raw("café")[0]));
+}
@@ -47,7 +47,24 @@ pub enum Input {
     DictEdit,
 }
 
+/// Shorter runs of text in entries that also have commands are kept as they are, as their length prefix would cost
+/// more than it saves
+pub const TEXT_RUN_MIN: usize = 3;
+
 impl Input {
+    /// Whether this is text of only printable ASCII, which the firmware can send without looking for commands in it
+    pub fn is_plain_text(&self) -> bool {
+        match self {
+            Input::String(s) => s.bytes().all(|b| (32..127).contains(&b)),
+            _ => false,
+        }
+    }
+
+    /// Whether this is text to be sent as a length-prefixed run in an entry that also has commands
+    pub fn is_text_run(&self) -> bool {
+        self.is_plain_text() && self.strlen() >= TEXT_RUN_MIN
+    }
+
     /// String length of this input segment
     fn strlen(&self) -> usize {
         match self {
@@ -107,11 +124,18 @@ impl Default for Entry {
 }
 
 impl Entry {
+    /// Whether the entry is only plain text, in which case the firmware sends it as is, with no runs needed
+    pub fn is_plain_text(&self) -> bool {
+        self.inputs.iter().all(Input::is_plain_text)
+    }
+
     /// Total length in bytes for the entry. Used to cheaply determine the size of a certain entry
     pub fn byte_len(&self) -> usize {
+        let plain_text = self.is_plain_text();
         self.inputs
             .iter()
             .map(|i| match i {
+                Input::String(s) if !plain_text && i.is_text_run() => s.len() + 2,
                 Input::String(s) => s.len(),
                 Input::Carry(s) => s.len() + 2,
                 Input::Keycodes(k) => k.len() + 2,
@@ -11,11 +11,15 @@ mod dict;
 mod freemap;
 mod hash;
 mod orthography;
+mod regex_ortho;
 mod rule;
 mod stroke;
+mod suffix_filter;
+mod word_list;
+mod workload;
 
-use std::fs::File;
-use std::io::{Seek, SeekFrom};
+use std::fs::{self, File};
+use std::io::{Seek, SeekFrom, Write};
 
 use clap::{App, Arg, SubCommand};
 
@@ -37,7 +41,19 @@ fn main() {
                         .multiple(true)
                         .min_values(1),
                 )
-                .arg(Arg::with_name("output").required(true)),
+                .arg(Arg::with_name("output").required(true))
+                .arg(
+                    Arg::with_name("freq")
+                        .long("freq")
+                        .takes_value(true)
+                        .help("Stroke log to lay out the most used entries first"),
+                )
+                .arg(
+                    Arg::with_name("words")
+                        .long("words")
+                        .takes_value(true)
+                        .help("Word list to check the orthography against (default the dictionary's own words)"),
+                ),
         )
         .subcommand(
             SubCommand::with_name("apply-rules")
@@ -45,6 +61,27 @@ fn main() {
                 .arg(Arg::with_name("from").required(true))
                 .arg(Arg::with_name("to").required(true)),
         )
+        .subcommand(
+            SubCommand::with_name("workload")
+                .about("Generates a stroke log for the host build's replay from a text corpus")
+                .arg(Arg::with_name("dict").required(true))
+                .arg(Arg::with_name("corpus").required(true))
+                .arg(Arg::with_name("output").required(true))
+                .arg(Arg::with_name("seed").long("seed").takes_value(true))
+                .arg(
+                    Arg::with_name("misstrokes")
+                        .long("misstrokes")
+                        .takes_value(true)
+                        .help("Chance of misstroking a word and undoing it (default 0.03)"),
+                )
+                .arg(
+                    Arg::with_name("suffixes")
+                        .long("suffixes")
+                        .takes_value(true)
+                        .help("Chance of stroking an inflected word as word + suffix (default 0.3)"),
+                )
+                .arg(Arg::with_name("wpm").long("wpm").takes_value(true)),
+        )
         .get_matches();
     match matches.subcommand() {
         ("compile", Some(m)) => {
@@ -60,15 +97,24 @@ fn main() {
                     )
                 })
                 .collect();
-            let dict = match Dict::parse(Dict::merge_dicts(inputs)) {
+            let merged = Dict::merge_dicts(inputs);
+            let words = match m.value_of("words") {
+                Some(f) => word_list::from_lines(&fs::read_to_string(f).expect("Cannot read word list!")),
+                None => word_list::from_translations(merged.values()),
+            };
+            let dict = match Dict::parse(merged) {
                 Ok(d) => d,
                 Err(e) => {
                     eprintln!("{}", e);
                     return;
                 }
             };
+            let usage = m.value_of("freq").map(|f| {
+                let log = fs::read_to_string(f).expect("Cannot read stroke log!");
+                workload::usage_counts(&dict, &log)
+            });
             let mut output_file = File::create(output_file).expect("output file");
-            if let Err(e) = compile::to_writer(dict, &mut output_file) {
+            if let Err(e) = compile::to_writer(dict, usage.as_ref(), &words, &mut output_file) {
                 eprintln!("{}", e);
                 return;
             };
@@ -89,6 +135,31 @@ fn main() {
                 File::create(m.value_of("to").unwrap()).expect("Cannot create output file!");
             serde_json::to_writer(output_file, &output_dict).expect("Write output file");
         }
+        ("workload", Some(m)) => {
+            let dict: dict::JsonDict = serde_json::from_reader(
+                File::open(m.value_of("dict").unwrap()).expect("Cannot open dict!"),
+            )
+            .expect("Dict file not valid JSON!");
+            let corpus =
+                fs::read_to_string(m.value_of("corpus").unwrap()).expect("Cannot read corpus!");
+            let opts = workload::Options {
+                seed: m.value_of("seed").map_or(1, |s| s.parse().expect("seed")),
+                misstroke_rate: m
+                    .value_of("misstrokes")
+                    .map_or(0.03, |s| s.parse().expect("misstrokes")),
+                suffix_rate: m
+                    .value_of("suffixes")
+                    .map_or(0.3, |s| s.parse().expect("suffixes")),
+                wpm: m.value_of("wpm").map_or(240, |s| s.parse().expect("wpm")),
+            };
+            let (lines, stats) = workload::generate(&dict, &corpus, &opts);
+            let mut output_file =
+                File::create(m.value_of("output").unwrap()).expect("Cannot create output file!");
+            for line in lines {
+                writeln!(output_file, "{}", line).expect("Write output file");
+            }
+            println!("{}", stats);
+        }
         ("test", Some(m)) => {
             let stroke: Stroke = m.value_of("stroke").unwrap().parse().unwrap();
             println!("{:x}", stroke.raw());
@@ -1,4 +1,4 @@
-use std::collections::BTreeMap;
+use std::collections::HashMap;
 
 use crate::hash;
 
@@ -20,30 +20,35 @@ pub struct SimpleRuleEntry {
     extra: String,
 }
 
-const BUCKET_SIZE: usize = 3;
+/// Buckets are a 3 byte word with the offset and length of the rule in the value blocks, followed by a byte with the
+/// upper 6 bits of the hash as a fingerprint and the inverted displacement from the home bucket in 2 bits. A lookup
+/// reads the buckets in one go from the home bucket, and only reads the rule of a bucket whose fingerprint matches,
+/// so a miss (most lookups) hardly ever reads a rule.
+const BUCKET_SIZE: usize = 4;
 const BUCKET_OFFSET_BITS: usize = 18;
 const BUCKET_LENGTH_BITS: usize = 6;
-const BUCKET_CAP: usize = 0x3C00; // 1463 entries in simple rules; generates 65470 bytes < 64KiB
-const EMPTY_BUCKET: u32 = 0xFFFFFF;
+const FINGERPRINT_SHIFT: usize = 26;
+/// Indexed by the lower bits of the hash; 1463 rules in simple rules, so a load of under a fifth, which keeps the
+/// runs of buckets read short
+const BUCKET_NUM: usize = 0x2000;
+/// Rules are laid out Robin Hood style like the dictionary's buckets, none more than this from its home bucket. The
+/// table has this many more buckets past the end instead of wrapping around, so a lookup is a single read
+const MAX_DISPLACEMENT: usize = 3;
+
+#[derive(Clone, Copy)]
+struct Bucket {
+    hash: u32,
+    word: u32,
+    displacement: usize,
+}
 
 pub fn generate() -> Vec<u8> {
     let rules: Vec<SimpleRuleEntry> = serde_json::from_str(RULE).unwrap();
-    let mut buckets = vec![EMPTY_BUCKET; BUCKET_CAP];
+    let mut buckets: Vec<Option<Bucket>> = vec![None; BUCKET_NUM + MAX_DISPLACEMENT];
     let mut value_blocks = Vec::new();
-    let mut collisions = BTreeMap::new();
     for rule in rules {
         // Use space as unique seperator
         let hash = hash::hash(format!("{} {}", rule.word, rule.suffix).as_bytes(), None);
-        let mut index = hash as usize % (BUCKET_CAP - 1);
-        let mut collision = 0;
-        while buckets[index] != EMPTY_BUCKET {
-            index = (index + 1) % (BUCKET_CAP - 1);
-            collision += 1;
-        }
-        collisions
-            .entry(collision)
-            .and_modify(|c| *c += 1)
-            .or_insert(1);
         let offset = value_blocks.len();
         value_blocks.extend_from_slice(rule.word.as_bytes());
         value_blocks.push(b' ');
@@ -52,21 +57,64 @@ pub fn generate() -> Vec<u8> {
         value_blocks.push(rule.back as u8);
         value_blocks.extend_from_slice(rule.extra.as_bytes());
         let len = value_blocks.len() - offset;
-        assert!(len < 2usize.pow(BUCKET_LENGTH_BITS as u32));
+        assert!(len < 2usize.pow(BUCKET_LENGTH_BITS as u32) - 1);
         assert!(offset < 2usize.pow(BUCKET_OFFSET_BITS as u32));
-        buckets[index] = (offset | (len << BUCKET_OFFSET_BITS)) as u32;
+        let mut bucket = Bucket {
+            hash,
+            word: (offset | (len << BUCKET_OFFSET_BITS)) as u32,
+            displacement: 0,
+        };
+        let mut index = hash as usize % BUCKET_NUM;
+        loop {
+            assert!(bucket.displacement <= MAX_DISPLACEMENT, "orthography rule too far from its home bucket");
+            match &mut buckets[index] {
+                None => {
+                    buckets[index] = Some(bucket);
+                    break;
+                }
+                Some(b) if b.displacement < bucket.displacement => std::mem::swap(b, &mut bucket),
+                Some(_) => {}
+            }
+            index += 1;
+            bucket.displacement += 1;
+        }
     }
 
-    dbg!(collisions);
+    let mut displacements = [0usize; MAX_DISPLACEMENT + 1];
+    for b in buckets.iter().flatten() {
+        displacements[b.displacement] += 1;
+    }
+    println!(
+        "Orthography buckets: {}/{} used, by displacement {:?}",
+        displacements.iter().sum::<usize>(),
+        BUCKET_NUM,
+        displacements
+    );
     let mut final_block: Vec<u8> = buckets
         .into_iter()
-        .map(|b| b.to_le_bytes()[0..BUCKET_SIZE].to_vec())
-        .flatten()
+        .flat_map(|b| {
+            let mut bytes = [0xFF; BUCKET_SIZE];
+            if let Some(b) = b {
+                bytes[..3].copy_from_slice(&b.word.to_le_bytes()[..3]);
+                bytes[3] = (b.hash >> FINGERPRINT_SHIFT << 2) as u8 | (3 ^ b.displacement as u8);
+            }
+            bytes.to_vec()
+        })
         .collect();
     final_block.extend(value_blocks);
     final_block
 }
 
+/// The rules by the word and suffix they match, with how many characters to take off the word and the text to put
+/// after
+pub fn rules() -> HashMap<(String, String), (usize, String)> {
+    let rules: Vec<SimpleRuleEntry> = serde_json::from_str(RULE).unwrap();
+    rules
+        .into_iter()
+        .map(|rule| ((rule.word, rule.suffix), (rule.back as usize, rule.extra)))
+        .collect()
+}
+
 #[test]
 /// Check if the full replacement matches the optimized data
 fn validate_simple_rules() {
@@ -87,3 +135,46 @@ fn test_gen() {
     let _raw_rules = generate();
     panic!("{}", _raw_rules.len());
 }
+
+#[test]
+/// Look up every rule the way the firmware does, and make sure other rules are hardly ever read on the way, for hits
+/// or misses
+fn test_lookup() {
+    let table = generate();
+    let values = BUCKET_SIZE * (BUCKET_NUM + MAX_DISPLACEMENT);
+    // The rule for `merged`, and how many rules were read to find it
+    let lookup = |merged: &str| -> (Option<&[u8]>, usize) {
+        let hash = hash::hash(merged.as_bytes(), None);
+        let mut reads = 0;
+        for (i, bucket) in table[hash as usize % BUCKET_NUM * BUCKET_SIZE..values]
+            .chunks(BUCKET_SIZE)
+            .enumerate()
+        {
+            let word = u32::from_le_bytes([bucket[0], bucket[1], bucket[2], 0]);
+            let len = (word >> BUCKET_OFFSET_BITS) as usize;
+            if len == (1 << BUCKET_LENGTH_BITS) - 1 || (3 ^ (bucket[3] & 3)) < i as u8 {
+                break;
+            }
+            if bucket[3] >> 2 != (hash >> FINGERPRINT_SHIFT) as u8 {
+                continue;
+            }
+            reads += 1;
+            let offset = values + (word as usize & ((1 << BUCKET_OFFSET_BITS) - 1));
+            let rule = &table[offset..offset + len];
+            if rule.starts_with(merged.as_bytes()) && rule[merged.len()] == 0 {
+                return (Some(rule), reads);
+            }
+        }
+        (None, reads)
+    };
+    let rules: Vec<SimpleRuleEntry> = serde_json::from_str(RULE).unwrap();
+    let mut hits = 0;
+    for rule in &rules {
+        let (found, reads) = lookup(&format!("{} {}", rule.word, rule.suffix));
+        assert!(found.is_some());
+        hits += reads;
+    }
+    assert!((hits - rules.len()) * 100 < rules.len());
+    let misses: usize = rules.iter().map(|rule| lookup(&format!("{} {}x", rule.word, rule.suffix)).1).sum();
+    assert!(misses * 100 < rules.len());
+}
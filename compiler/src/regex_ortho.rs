@@ -0,0 +1,474 @@
+//! Compiles the regex orthography rules into automata for the firmware, so that the rules come with the dictionary
+//! rather than being written into the firmware. Each rule has a pattern for the end of the word and one for the start
+//! of the suffix, in a small subset of regex (letters, classes, `\w`, `\W`, groups, `|`, `+`, `*` and `?`, with `^`
+//! for the start of the word and `$` for the end of the suffix). The suffix patterns are made into a DFA that's run
+//! forwards over the suffix, which ends in the set of rules whose suffixes match. Each set has a DFA of the word
+//! patterns in it, reversed, that's run backwards from the end of the word and ends in the first rule that matches.
+//! Each is a single pass that stops as soon as no (earlier) rule can match any more.
+//!
+//! Layout (offsets from `REGEX_START`):
+//! - 0: what each rule does, `ACTION_SIZE` bytes each: the number of characters to take off the word, the number of
+//!   characters to leave off the start of the suffix, and the text to put in between them, padded with 0. Bytes of
+//!   the text below `CAPTURE_END` stand for the character that many from the end of the word.
+//! - `ROWS_START`: the transitions of the states that aren't final, one byte for each of the `SYMBOLS`, starting with
+//!   the suffix DFA. A final state has `FINAL` set: for the suffix DFA, the row of the word DFA to go on with, and for
+//!   the word DFAs, the rule. `NO_RULE` if none can match.
+use std::collections::{BTreeMap, BTreeSet, VecDeque};
+
+static RULE: &str = include_str!("../regex-rules.json");
+
+#[derive(Deserialize)]
+struct RegexRule {
+    /// Pattern for the end of the word
+    word: String,
+    /// Pattern for the start of the suffix
+    suffix: String,
+    /// The number of characters to be backspaced from the end of the word
+    back: u8,
+    /// Text to append after the partial word, where `\1` to `\7` is that character from the end of the word
+    text: String,
+    /// The number of characters at the start of the suffix that are not appended after `text`
+    from: u8,
+    /// A word, suffix and the result of the rule, for the tests
+    #[allow(dead_code)]
+    example: [String; 3],
+}
+
+/// The end of the input, then `a` to `z`, any other letter, and anything else; as `regex_symbol` in the firmware
+const SYMBOLS: usize = 29;
+const END: u32 = 1;
+const ALPHA: u32 = ((1 << 28) - 1) & !END;
+const NON_ALPHA: u32 = 1 << 28;
+const ANY: u32 = ALPHA | NON_ALPHA;
+
+pub const REGEX_START: usize = 0x10000;
+const REGEX_SIZE: usize = 0x1000;
+const ACTION_SIZE: usize = 8;
+const ROWS_START: usize = 0x100;
+const FINAL: u8 = 0x80;
+const NO_RULE: u8 = 0xFF;
+const CAPTURE_END: u8 = 8;
+
+#[derive(Debug)]
+enum Node {
+    /// One symbol out of a set, as a bit mask
+    Set(u32),
+    Concat(Vec<Node>),
+    Alt(Vec<Node>),
+    /// The node at least once if `min_one`, and any number of times if `many`
+    Repeat(Box<Node>, bool, bool),
+}
+
+fn symbol_set(c: u8) -> u32 {
+    match c {
+        b'a'..=b'z' => 1 << (c - b'a' + 1),
+        _ => panic!("only lowercase letters can be matched in orthography rules, not {:?}", c as char),
+    }
+}
+
+struct Parser<'a> {
+    pat: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Parser<'a> {
+    fn parse(pat: &'a str) -> Node {
+        let mut parser = Parser { pat: pat.as_bytes(), pos: 0 };
+        let node = parser.alt();
+        assert!(parser.pos == pat.len(), "unmatched ')' in {:?}", pat);
+        node
+    }
+
+    fn peek(&self) -> Option<u8> {
+        self.pat.get(self.pos).copied()
+    }
+
+    fn next(&mut self) -> u8 {
+        let c = self.peek().unwrap_or_else(|| panic!("unexpected end of {:?}", std::str::from_utf8(self.pat).unwrap()));
+        self.pos += 1;
+        c
+    }
+
+    fn alt(&mut self) -> Node {
+        let mut alts = vec![self.concat()];
+        while self.peek() == Some(b'|') {
+            self.pos += 1;
+            alts.push(self.concat());
+        }
+        if alts.len() == 1 {
+            alts.pop().unwrap()
+        } else {
+            Node::Alt(alts)
+        }
+    }
+
+    fn concat(&mut self) -> Node {
+        let mut nodes = Vec::new();
+        while let Some(c) = self.peek() {
+            if c == b'|' || c == b')' {
+                break;
+            }
+            let atom = self.atom();
+            let (min_one, many) = match self.peek() {
+                Some(b'+') => (true, true),
+                Some(b'*') => (false, true),
+                Some(b'?') => (false, false),
+                _ => {
+                    nodes.push(atom);
+                    continue;
+                }
+            };
+            self.pos += 1;
+            nodes.push(Node::Repeat(Box::new(atom), min_one, many));
+        }
+        Node::Concat(nodes)
+    }
+
+    fn atom(&mut self) -> Node {
+        match self.next() {
+            b'(' => {
+                if self.peek() == Some(b'?') {
+                    self.pos += 1;
+                    assert!(self.next() == b':', "only non-capturing groups are supported");
+                }
+                let node = self.alt();
+                assert!(self.next() == b')');
+                node
+            }
+            b'[' => {
+                let negated = self.peek() == Some(b'^');
+                if negated {
+                    self.pos += 1;
+                }
+                let mut set = 0;
+                while self.peek() != Some(b']') {
+                    let from = self.next();
+                    if self.peek() == Some(b'-') {
+                        self.pos += 1;
+                        let to = self.next();
+                        set |= (from..=to).map(symbol_set).fold(0, |a, b| a | b);
+                    } else {
+                        set |= symbol_set(from);
+                    }
+                }
+                self.pos += 1;
+                Node::Set(if negated { ANY & !set } else { set })
+            }
+            b'\\' => match self.next() {
+                b'w' => Node::Set(ALPHA),
+                b'W' => Node::Set(NON_ALPHA),
+                c => panic!("unknown escape \\{}", c as char),
+            },
+            b'^' | b'$' => Node::Set(END),
+            b'.' => Node::Set(ANY),
+            c => Node::Set(symbol_set(c)),
+        }
+    }
+}
+
+impl Node {
+    fn reverse(self) -> Node {
+        match self {
+            Node::Concat(nodes) => Node::Concat(nodes.into_iter().rev().map(Node::reverse).collect()),
+            Node::Alt(nodes) => Node::Alt(nodes.into_iter().map(Node::reverse).collect()),
+            Node::Repeat(node, min_one, many) => Node::Repeat(Box::new(node.reverse()), min_one, many),
+            set => set,
+        }
+    }
+
+    /// The fewest characters it matches, not counting the end
+    fn min_len(&self) -> usize {
+        match self {
+            Node::Set(set) => (set & !END != 0) as usize,
+            Node::Concat(nodes) => nodes.iter().map(Node::min_len).sum(),
+            Node::Alt(nodes) => nodes.iter().map(Node::min_len).min().unwrap_or(0),
+            Node::Repeat(node, min_one, _) => if *min_one { node.min_len() } else { 0 },
+        }
+    }
+}
+
+#[derive(Default)]
+struct NfaState {
+    eps: Vec<usize>,
+    trans: Vec<(u32, usize)>,
+    accept: bool,
+    /// The rule it's part of
+    rule: usize,
+}
+
+/// Thompson construction of the patterns of all rules, each with its own start
+struct Nfa {
+    states: Vec<NfaState>,
+    starts: Vec<usize>,
+}
+
+impl Nfa {
+    fn new(patterns: &[Node]) -> Self {
+        let mut nfa = Nfa { states: Vec::new(), starts: Vec::new() };
+        for (rule, pat) in patterns.iter().enumerate() {
+            let start = nfa.add(rule);
+            nfa.starts.push(start);
+            let end = nfa.build(pat, start);
+            nfa.states[end].accept = true;
+        }
+        nfa
+    }
+
+    fn add(&mut self, rule: usize) -> usize {
+        self.states.push(NfaState { rule, ..Default::default() });
+        self.states.len() - 1
+    }
+
+    /// Builds `node` from `start`, returning the state it ends in
+    fn build(&mut self, node: &Node, start: usize) -> usize {
+        let rule = self.states[start].rule;
+        match node {
+            Node::Set(set) => {
+                let end = self.add(rule);
+                self.states[start].trans.push((*set, end));
+                end
+            }
+            Node::Concat(nodes) => nodes.iter().fold(start, |s, n| self.build(n, s)),
+            Node::Alt(nodes) => {
+                let end = self.add(rule);
+                for node in nodes {
+                    let s = self.add(rule);
+                    self.states[start].eps.push(s);
+                    let e = self.build(node, s);
+                    self.states[e].eps.push(end);
+                }
+                end
+            }
+            Node::Repeat(node, min_one, many) => {
+                let s = self.add(rule);
+                self.states[start].eps.push(s);
+                let e = self.build(node, s);
+                let end = self.add(rule);
+                self.states[e].eps.push(end);
+                if *many {
+                    self.states[e].eps.push(s);
+                }
+                if !min_one {
+                    self.states[start].eps.push(end);
+                }
+                end
+            }
+        }
+    }
+
+    /// The states with transitions reachable from `states`, and the rules accepted on the way
+    fn closure(&self, states: impl IntoIterator<Item = usize>) -> (BTreeSet<usize>, u32) {
+        let mut seen = BTreeSet::new();
+        let mut stack: Vec<usize> = states.into_iter().collect();
+        let mut mask = 0;
+        while let Some(s) = stack.pop() {
+            if !seen.insert(s) {
+                continue;
+            }
+            if self.states[s].accept {
+                mask |= 1 << self.states[s].rule;
+            }
+            stack.extend(&self.states[s].eps);
+        }
+        seen.retain(|&s| !self.states[s].trans.is_empty());
+        (seen, mask)
+    }
+
+    /// The states after `sym` from `states`, and the rules accepted on the way
+    fn step(&self, states: &BTreeSet<usize>, sym: usize) -> (BTreeSet<usize>, u32) {
+        self.closure(
+            states
+                .iter()
+                .flat_map(|&s| self.states[s].trans.iter())
+                .filter(|(set, _)| set & (1 << sym) != 0)
+                .map(|&(_, t)| t),
+        )
+    }
+}
+
+/// Adds the rows of the states reachable from `start` that aren't final to `rows`, where `step` gives the next state
+/// after a symbol, or the byte of the final state; returns the row of `start`. States already in `ids` are shared
+fn add_rows<K: Ord + Clone>(
+    rows: &mut Vec<[u8; SYMBOLS]>,
+    ids: &mut BTreeMap<K, usize>,
+    start: K,
+    mut step: impl FnMut(&K, usize) -> Result<K, u8>,
+) -> usize {
+    let mut queue = VecDeque::new();
+    let mut row_of = |rows: &mut Vec<[u8; SYMBOLS]>, queue: &mut VecDeque<K>, key: K| {
+        *ids.entry(key.clone()).or_insert_with(|| {
+            rows.push([0; SYMBOLS]);
+            queue.push_back(key);
+            rows.len() - 1
+        })
+    };
+    let start = row_of(rows, &mut queue, start);
+    while let Some(key) = queue.pop_front() {
+        let row = row_of(rows, &mut queue, key.clone());
+        for sym in 0..SYMBOLS {
+            rows[row][sym] = match step(&key, sym) {
+                Ok(next) => row_of(rows, &mut queue, next) as u8,
+                Err(byte) => byte,
+            };
+        }
+    }
+    start
+}
+
+pub fn generate() -> Vec<u8> {
+    let (block, rules, suffix_rows, word_rows) = build();
+    println!(
+        "Regex orthography: {} rules, {} states for the suffixes, {} for the words",
+        rules, suffix_rows, word_rows
+    );
+    block
+}
+
+/// The block, and the number of rules and of states in the suffix and word DFAs
+pub fn build() -> (Vec<u8>, usize, usize, usize) {
+    let rules: Vec<RegexRule> = serde_json::from_str(RULE).unwrap();
+    assert!(rules.len() < NO_RULE as usize - FINAL as usize && rules.len() * ACTION_SIZE <= ROWS_START);
+    let mut words = Vec::new();
+    let mut suffixes = Vec::new();
+    let mut block = vec![0; ROWS_START];
+    for (i, rule) in rules.iter().enumerate() {
+        let word = Parser::parse(&rule.word).reverse();
+        let suffix = Parser::parse(&rule.suffix);
+        let action = &mut block[i * ACTION_SIZE..][..ACTION_SIZE];
+        action[0] = rule.back;
+        action[1] = rule.from;
+        let mut text = rule.text.bytes();
+        let mut len = 2;
+        while let Some(c) = text.next() {
+            action[len] = if c == b'\\' { text.next().unwrap() - b'0' } else { c };
+            assert!(action[len] != 0 && action[len] != b'\\');
+            assert!(action[len] >= CAPTURE_END || (action[len] as usize) <= word.min_len());
+            len += 1;
+        }
+        assert!((rule.back as usize) <= word.min_len() && (rule.from as usize) <= suffix.min_len());
+        words.push(word);
+        suffixes.push(suffix);
+    }
+
+    // The suffix DFA keeps the set of rules matched so far, and ends in the set of all the rules that match, for now
+    // as its index in `sets`
+    let nfa = Nfa::new(&suffixes);
+    let mut rows = Vec::new();
+    let mut sets = vec![];
+    let mut set_ids = BTreeMap::new();
+    let start = nfa.closure(nfa.starts.iter().copied());
+    add_rows(&mut rows, &mut BTreeMap::new(), start, |(states, mask), sym| {
+        let (next, accepted) = nfa.step(states, sym);
+        let mask = mask | accepted;
+        // Nothing comes after the end
+        if sym == 0 || next.is_empty() {
+            Err(FINAL | *set_ids.entry(mask).or_insert_with(|| {
+                sets.push(mask);
+                assert!(sets.len() <= FINAL as usize);
+                sets.len() as u8 - 1
+            }))
+        } else {
+            Ok((next, mask))
+        }
+    });
+    let suffix_rows = rows.len();
+
+    // The word DFA for each set only has the rules in it, and only the first rule that matches counts, so it stops as
+    // soon as none of the rules before it can match
+    let nfa = Nfa::new(&words);
+    let first = |states: BTreeSet<usize>, best: usize, accepted: u32| {
+        let best = best.min(accepted.trailing_zeros() as usize);
+        (states.into_iter().filter(|&s| nfa.states[s].rule < best).collect::<BTreeSet<_>>(), best)
+    };
+    let mut word_ids = BTreeMap::new();
+    let word_starts: Vec<u8> = sets
+        .iter()
+        .map(|&set| {
+            if set == 0 {
+                return NO_RULE;
+            }
+            let (states, accepted) = nfa.closure((0..rules.len()).filter(|r| set & 1 << r != 0).map(|r| nfa.starts[r]));
+            let start = first(states, rules.len(), accepted);
+            FINAL | add_rows(&mut rows, &mut word_ids, start, |(states, best), sym| {
+                let (next, accepted) = nfa.step(states, sym);
+                let (next, best) = first(next, *best, accepted);
+                if sym == 0 || next.is_empty() {
+                    Err(if best < rules.len() { FINAL | best as u8 } else { NO_RULE })
+                } else {
+                    Ok((next, best))
+                }
+            }) as u8
+        })
+        .collect();
+    assert!(rows.len() < (NO_RULE - FINAL) as usize && ROWS_START + rows.len() * SYMBOLS <= REGEX_SIZE);
+    let word_rows = rows.len() - suffix_rows;
+    for row in &mut rows[..suffix_rows] {
+        for byte in row.iter_mut().filter(|b| **b & FINAL != 0) {
+            *byte = word_starts[(*byte & !FINAL) as usize];
+        }
+    }
+    block.extend(rows.into_iter().flatten());
+    (block, rules.len(), suffix_rows, word_rows)
+}
+
+fn symbol(c: u8) -> usize {
+    match c {
+        0 => 0,
+        b'a'..=b'z' => (c - b'a' + 1) as usize,
+        b'A'..=b'Z' => 27,
+        _ => 28,
+    }
+}
+
+/// What the firmware does with the block: how many characters to take off `word`, and what to append after
+pub fn apply(block: &[u8], word: &str, suffix: &str) -> Option<(usize, String)> {
+    let run = |mut state: u8, input: &mut dyn Iterator<Item = u8>| {
+        while state & FINAL == 0 {
+            state = block[ROWS_START + state as usize * SYMBOLS + symbol(input.next().unwrap_or(0))];
+        }
+        state
+    };
+    let start = run(0, &mut suffix.bytes());
+    if start == NO_RULE {
+        return None;
+    }
+    let rule = run(start & !FINAL, &mut word.bytes().rev());
+    if rule == NO_RULE {
+        return None;
+    }
+    let action = &block[(rule & !FINAL) as usize * ACTION_SIZE..][..ACTION_SIZE];
+    let mut output: String = action[2..]
+        .iter()
+        .take_while(|&&c| c != 0)
+        .map(|&c| if c < CAPTURE_END { word.as_bytes()[word.len() - c as usize] as char } else { c as char })
+        .collect();
+    output.push_str(&suffix[action[1] as usize..]);
+    Some((action[0] as usize, output))
+}
+
+#[test]
+fn test_examples() {
+    let block = generate();
+    let rules: Vec<RegexRule> = serde_json::from_str(RULE).unwrap();
+    for rule in &rules {
+        let [word, suffix, full] = &rule.example;
+        // The firmware only has the last 7 characters of the word
+        let end = &word[word.len().saturating_sub(7)..];
+        let (back, output) = apply(&block, end, suffix).unwrap_or_else(|| panic!("no rule for {} + {}", word, suffix));
+        assert_eq!(&format!("{}{}", &word[..word.len() - back], output), full);
+    }
+}
+
+#[test]
+fn test_no_match() {
+    let block = generate();
+    for (word, suffix) in [("walk", "ing"), ("cat", ","), ("", "s"), ("run", ""), ("box", "ing")] {
+        assert_eq!(apply(&block, word, suffix), None, "{} + {}", word, suffix);
+    }
+    // Rules earlier in the list come first
+    assert_eq!(apply(&block, "operate", "er"), Some((1, "or".to_string())));
+    assert_eq!(apply(&block, "church", "s."), Some((0, "es.".to_string())));
+    assert_eq!(apply(&block, "search", "s"), Some((0, "es".to_string())));
+    assert_eq!(apply(&block, "garch", "s"), None);
+    assert_eq!(apply(&block, "quit", "ing"), Some((0, "ting".to_string())));
+}
@@ -33,9 +33,11 @@ impl Stroke {
     }
 }
 
+/// Hashed from the last stroke backwards, so that the firmware can extend the hash of a suffix of the strokes to a
+/// longer suffix when searching
 pub fn hash_strokes(strokes: &Strokes) -> u32 {
     let mut hash = None;
-    for stroke in &strokes.0 {
+    for stroke in strokes.0.iter().rev() {
         hash = Some(stroke.hash(hash));
     }
     hash.unwrap()
@@ -154,3 +156,12 @@ impl FromStr for Stroke {
         Ok(res)
     }
 }
+
+#[test]
+fn test_hash_strokes_extends_suffix() {
+    let strokes: Vec<Stroke> = ["KAT", "HRAOG", "-S"].iter().map(|s| s.parse().unwrap()).collect();
+    let last = hash_strokes(&Strokes(strokes[2..].to_vec()));
+    let last_two = hash_strokes(&Strokes(strokes[1..].to_vec()));
+    assert_eq!(strokes[1].hash(Some(last)), last_two);
+    assert_eq!(strokes[0].hash(Some(last_two)), hash_strokes(&Strokes(strokes)));
+}
@@ -0,0 +1,158 @@
+//! Filter over the stroke sequences of multi-stroke entries and their proper prefixes, so that the firmware can
+//! skip the bucket lookups for the candidates that can't be in the dictionary, and keep track of which candidates
+//! can still become an entry with more strokes. It is a blocked Bloom filter, where the block is picked by the hash
+//! of the last two strokes; every candidate with more than one stroke for the current stroke then shares a single
+//! block, which takes one read. Each block has the bits for the entries in the first half, and the bits for the
+//! prefixes in the second. The bits are cleared (rather than set) for the sequences present, so that the firmware
+//! can add to it without erasing.
+use std::collections::BTreeSet;
+use std::fmt::{self, Display, Formatter};
+
+use crate::stroke::{hash_strokes, Strokes};
+
+pub const BLOCK_SIZE: usize = 32;
+const HALF_SIZE: usize = BLOCK_SIZE / 2;
+pub const BLOCK_NUM: usize = 0x4000;
+const BLOCK_SHIFT: u32 = 18;
+const HASH_NUM: u32 = 3;
+const BIT_SHIFT: u32 = 7;
+
+/// One half of all the blocks
+struct Half {
+    offset: usize,
+    keys: usize,
+    block_keys: Vec<u16>,
+}
+
+pub struct SuffixFilter {
+    blocks: Vec<u8>,
+    entries: Half,
+    prefixes: Half,
+    seen_prefixes: BTreeSet<Strokes>,
+}
+
+fn bits(hash: u32) -> impl Iterator<Item = usize> {
+    (0..HASH_NUM).map(move |i| ((hash >> (BIT_SHIFT * i)) & (HALF_SIZE as u32 * 8 - 1)) as usize)
+}
+
+impl Half {
+    fn new(offset: usize) -> Self {
+        Half {
+            offset,
+            keys: 0,
+            block_keys: vec![0; BLOCK_NUM],
+        }
+    }
+
+    fn add(&mut self, blocks: &mut [u8], strokes: &Strokes) {
+        let block = SuffixFilter::block(strokes);
+        for bit in bits(hash_strokes(strokes)) {
+            blocks[block * BLOCK_SIZE + self.offset + bit / 8] &= !(1 << (bit % 8));
+        }
+        self.keys += 1;
+        self.block_keys[block] = self.block_keys[block].saturating_add(1);
+    }
+
+    #[cfg(test)]
+    fn contains(&self, blocks: &[u8], strokes: &Strokes) -> bool {
+        let block = SuffixFilter::block(strokes);
+        bits(hash_strokes(strokes))
+            .all(|bit| blocks[block * BLOCK_SIZE + self.offset + bit / 8] & (1 << (bit % 8)) == 0)
+    }
+
+    fn block_fpr(&self, blocks: &[u8], block: usize) -> f64 {
+        let start = block * BLOCK_SIZE + self.offset;
+        let set: u32 = blocks[start..start + HALF_SIZE].iter().map(|b| b.count_zeros()).sum();
+        (set as f64 / (HALF_SIZE * 8) as f64).powi(HASH_NUM as i32)
+    }
+
+    /// False positive rate for a candidate whose last two strokes are those of a random key
+    fn weighted_fpr(&self, blocks: &[u8]) -> f64 {
+        (0..BLOCK_NUM)
+            .map(|b| self.block_keys[b] as f64 * self.block_fpr(blocks, b))
+            .sum::<f64>()
+            / self.keys.max(1) as f64
+    }
+
+    /// False positive rate for a candidate with random last two strokes
+    fn uniform_fpr(&self, blocks: &[u8]) -> f64 {
+        (0..BLOCK_NUM).map(|b| self.block_fpr(blocks, b)).sum::<f64>() / BLOCK_NUM as f64
+    }
+
+    fn fmt(&self, f: &mut Formatter, blocks: &[u8], name: &str) -> fmt::Result {
+        writeln!(
+            f,
+            "  {}: {}, {:.2} bits each, at most {} in a block, false positive rate {:.3}% (uniform), {:.3}% (weighted)",
+            name,
+            self.keys,
+            (BLOCK_NUM * HALF_SIZE * 8) as f64 / self.keys.max(1) as f64,
+            self.block_keys.iter().max().unwrap_or(&0),
+            self.uniform_fpr(blocks) * 100.0,
+            self.weighted_fpr(blocks) * 100.0
+        )
+    }
+}
+
+impl SuffixFilter {
+    pub fn new() -> Self {
+        SuffixFilter {
+            blocks: vec![0xFF; BLOCK_SIZE * BLOCK_NUM],
+            entries: Half::new(0),
+            prefixes: Half::new(HALF_SIZE),
+            seen_prefixes: BTreeSet::new(),
+        }
+    }
+
+    fn block(strokes: &Strokes) -> usize {
+        let last_two = Strokes(strokes.0[strokes.len() - 2..].to_vec());
+        (hash_strokes(&last_two) >> BLOCK_SHIFT) as usize % BLOCK_NUM
+    }
+
+    /// Adds the entry and its proper prefixes; single stroke entries and prefixes are not filtered
+    pub fn add(&mut self, strokes: &Strokes) {
+        if strokes.len() < 2 {
+            return;
+        }
+        self.entries.add(&mut self.blocks, strokes);
+        for len in 2..strokes.len() {
+            let prefix = Strokes(strokes.0[..len].to_vec());
+            if !self.seen_prefixes.contains(&prefix) {
+                self.prefixes.add(&mut self.blocks, &prefix);
+                self.seen_prefixes.insert(prefix);
+            }
+        }
+    }
+
+    pub fn as_bytes(&self) -> &[u8] {
+        &self.blocks
+    }
+}
+
+impl Display for SuffixFilter {
+    fn fmt(&self, f: &mut Formatter) -> fmt::Result {
+        writeln!(f, "Suffix filter: {} bytes", self.blocks.len())?;
+        self.entries.fmt(f, &self.blocks, "Entries")?;
+        self.prefixes.fmt(f, &self.blocks, "Prefixes")
+    }
+}
+
+#[test]
+fn test_filter() {
+    let parse = |s: &str| Strokes(s.split('/').map(|s| s.parse().unwrap()).collect());
+    let mut filter = SuffixFilter::new();
+    let entries = ["KAT/HRAOG", "TEFT/-G/-S", "A/TPHOER/TPH*EU/STKPWHR"];
+    for e in &entries {
+        filter.add(&parse(e));
+    }
+    for e in &entries {
+        assert!(filter.entries.contains(&filter.blocks, &parse(e)));
+        assert!(!filter.prefixes.contains(&filter.blocks, &parse(e)));
+    }
+    assert!(!filter.entries.contains(&filter.blocks, &parse("HRAOG/KAT")));
+    assert!(!filter.entries.contains(&filter.blocks, &parse("TPHOER/TPH*EU/STKPWHR")));
+    assert!(filter.prefixes.contains(&filter.blocks, &parse("TEFT/-G")));
+    assert!(filter.prefixes.contains(&filter.blocks, &parse("A/TPHOER/TPH*EU")));
+    assert!(!filter.prefixes.contains(&filter.blocks, &parse("TPHOER/TPH*EU")));
+    assert_eq!(filter.entries.keys, 3);
+    assert_eq!(filter.prefixes.keys, 3);
+}
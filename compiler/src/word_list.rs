@@ -0,0 +1,269 @@
+//! Word list for the firmware to check the results of the orthography rules against, as a minimal acyclic automaton
+//! (DAFSA) of the words in lowercase. Looking a word up is a walk from the root, one node per character, and the
+//! firmware reads it with a streamed read, so what a walk costs is mostly how many times it has to address a read
+//! again. Each node is laid out with its child with the most words right after it where possible, so that the walk
+//! down the common paths carries on in the same read.
+//!
+//! Each node is a header (`FINAL` if a word ends there, `FALLTHROUGH` if the first edge's child is right after it, and
+//! the number of edges in the lower bits), the edges' labels, then the 3 byte offsets of the edges' children, but for
+//! the first one with `FALLTHROUGH`. The root is at 0.
+use std::collections::HashMap;
+
+/// Up to `FREEMAP_START`
+const WORDS_SIZE: usize = 0x60000;
+const FINAL: u8 = 0x80;
+const FALLTHROUGH: u8 = 0x40;
+/// So that the header is never 0xFF, which is no word list at all
+const MAX_EDGES: usize = 0x3E;
+/// Skipping up to this many bytes in the read is cheaper than addressing a new one; as `WORDS_SKIP_MAX` in the
+/// firmware
+const SKIP_MAX: usize = 4;
+
+/// Whether `word` can be checked on the firmware
+fn is_word(word: &str) -> bool {
+    !word.is_empty() && word.bytes().all(|c| c.is_ascii_alphabetic() || c == b'\'' || c == b'-')
+}
+
+/// The words out of the translations of a dictionary, for when there's no word list
+pub fn from_translations<'a>(translations: impl Iterator<Item = &'a String>) -> Vec<String> {
+    translations.filter(|t| is_word(t)).cloned().collect()
+}
+
+/// The words out of a word list with one word per line, optionally followed by anything else (e.g. its rank)
+pub fn from_lines(list: &str) -> Vec<String> {
+    list.lines()
+        .filter_map(|line| line.split_whitespace().next())
+        .filter(|w| is_word(w))
+        .map(String::from)
+        .collect()
+}
+
+#[derive(Default)]
+struct Node {
+    is_final: bool,
+    edges: Vec<(u8, usize)>,
+}
+
+struct Dafsa {
+    nodes: Vec<Node>,
+}
+
+impl Dafsa {
+    /// Builds the automaton one word at a time in order, merging the nodes after the prefix that the next word
+    /// shares with the last into equal ones that are there already
+    fn new(words: &[String]) -> Self {
+        let mut dafsa = Dafsa { nodes: vec![Node::default()] };
+        let mut register = HashMap::new();
+        // The edges of the last word that aren't merged yet
+        let mut unchecked: Vec<(usize, usize)> = Vec::new();
+        let mut last: &[u8] = &[];
+        for word in words {
+            let word = word.as_bytes();
+            let common = word.iter().zip(last).take_while(|(a, b)| a == b).count();
+            dafsa.merge(&mut register, &mut unchecked, common);
+            let mut node = unchecked.last().map_or(0, |&(_, child)| child);
+            for &c in &word[common..] {
+                dafsa.nodes.push(Node::default());
+                let child = dafsa.nodes.len() - 1;
+                dafsa.nodes[node].edges.push((c, child));
+                unchecked.push((node, child));
+                node = child;
+            }
+            dafsa.nodes[node].is_final = true;
+            last = word;
+        }
+        dafsa.merge(&mut register, &mut unchecked, 0);
+        dafsa
+    }
+
+    fn merge(
+        &mut self,
+        register: &mut HashMap<(bool, Vec<(u8, usize)>), usize>,
+        unchecked: &mut Vec<(usize, usize)>,
+        down_to: usize,
+    ) {
+        while unchecked.len() > down_to {
+            let (parent, child) = unchecked.pop().unwrap();
+            let key = (self.nodes[child].is_final, self.nodes[child].edges.clone());
+            match register.get(&key) {
+                Some(&existing) => self.nodes[parent].edges.last_mut().unwrap().1 = existing,
+                None => {
+                    register.insert(key, child);
+                }
+            }
+        }
+    }
+
+    /// The number of words from each node
+    fn weights(&self) -> Vec<usize> {
+        fn weight(dafsa: &Dafsa, node: usize, weights: &mut Vec<Option<usize>>) -> usize {
+            if let Some(w) = weights[node] {
+                return w;
+            }
+            let w = dafsa.nodes[node].is_final as usize
+                + dafsa.nodes[node].edges.iter().map(|&(_, c)| weight(dafsa, c, weights)).sum::<usize>();
+            weights[node] = Some(w);
+            w
+        }
+        let mut weights = vec![None; self.nodes.len()];
+        weight(self, 0, &mut weights);
+        weights.into_iter().map(|w| w.unwrap_or(0)).collect()
+    }
+}
+
+/// How the nodes are laid out: the offset of each, and the edges of each in the order they're written
+struct Layout {
+    offsets: Vec<Option<usize>>,
+    order: Vec<(usize, bool, Vec<(u8, usize)>)>,
+    len: usize,
+}
+
+
+impl Layout {
+    fn place(&mut self, dafsa: &Dafsa, weights: &[usize], node: usize) {
+        let mut edges = dafsa.nodes[node].edges.clone();
+        assert!(edges.len() <= MAX_EDGES);
+        edges.sort_by_key(|&(c, child)| (std::cmp::Reverse(weights[child]), c));
+        // The heaviest child that's not somewhere else already comes first, and goes right after
+        let next = edges.iter().position(|&(_, child)| self.offsets[child].is_none());
+        if let Some(i) = next {
+            let edge = edges.remove(i);
+            edges.insert(0, edge);
+        }
+        self.offsets[node] = Some(self.len);
+        self.len += 1 + edges.len() + 3 * (edges.len() - next.is_some() as usize);
+        self.order.push((node, next.is_some(), edges.clone()));
+        for (_, child) in edges {
+            if self.offsets[child].is_none() {
+                self.place(dafsa, weights, child);
+            }
+        }
+    }
+}
+
+/// The walk of the firmware over the block: the reads it would address, and the bytes it would read
+struct Walk<'a> {
+    block: &'a [u8],
+    pos: usize,
+    reads: usize,
+    bytes: usize,
+}
+
+impl<'a> Walk<'a> {
+    fn read(&mut self, len: usize) -> &'a [u8] {
+        self.pos += len;
+        self.bytes += len;
+        &self.block[self.pos - len..self.pos]
+    }
+
+    fn seek(&mut self, to: usize) {
+        if to >= self.pos && to - self.pos <= SKIP_MAX {
+            self.bytes += to - self.pos;
+        } else {
+            self.reads += 1;
+        }
+        self.pos = to;
+    }
+
+    /// Whether `word` is in the block
+    fn lookup(&mut self, word: &[u8]) -> bool {
+        self.reads += 1;
+        let mut header = self.read(1)[0];
+        if header == 0xFF {
+            return false;
+        }
+        for &c in word {
+            let labels = self.pos;
+            let len = (header & !(FINAL | FALLTHROUGH)) as usize;
+            let fallthrough = (header & FALLTHROUGH != 0) as usize;
+            let edge = match (0..len).find(|_| self.read(1)[0] == c) {
+                Some(i) => i,
+                None => return false,
+            };
+            if fallthrough == 1 && edge == 0 {
+                self.seek(labels + len + 3 * (len - 1));
+            } else {
+                self.seek(labels + len + 3 * (edge - fallthrough));
+                let addr = self.read(3);
+                self.seek(u32::from_le_bytes([addr[0], addr[1], addr[2], 0]) as usize);
+            }
+            header = self.read(1)[0];
+        }
+        header & FINAL != 0
+    }
+}
+
+/// Whether `word` is in `block`, how many reads and how many bytes it takes
+fn lookup(block: &[u8], word: &[u8]) -> (bool, usize, usize) {
+    let mut walk = Walk { block, pos: 0, reads: 0, bytes: 0 };
+    let found = walk.lookup(word);
+    (found, walk.reads, walk.bytes)
+}
+
+pub fn generate(words: &[String]) -> Vec<u8> {
+    let mut words: Vec<String> = words.iter().map(|w| w.to_ascii_lowercase()).collect();
+    words.sort();
+    words.dedup();
+    if words.is_empty() {
+        return Vec::new();
+    }
+    let dafsa = Dafsa::new(&words);
+    let weights = dafsa.weights();
+    let mut layout = Layout {
+        offsets: vec![None; dafsa.nodes.len()],
+        order: Vec::new(),
+        len: 0,
+    };
+    layout.place(&dafsa, &weights, 0);
+
+    let mut block = Vec::with_capacity(layout.len);
+    for (node, fallthrough, edges) in &layout.order {
+        let header = (dafsa.nodes[*node].is_final as u8 * FINAL) | (*fallthrough as u8 * FALLTHROUGH);
+        block.push(header | edges.len() as u8);
+        block.extend(edges.iter().map(|&(c, _)| c));
+        for &(_, child) in edges.iter().skip(*fallthrough as usize) {
+            block.extend_from_slice(&(layout.offsets[child].unwrap() as u32).to_le_bytes()[..3]);
+        }
+    }
+    assert!(block.len() <= WORDS_SIZE, "word list too big: {} bytes", block.len());
+
+    let (mut total_reads, mut total_bytes, mut max_reads, mut max_bytes) = (0, 0, 0, 0);
+    for word in &words {
+        let (found, reads, bytes) = lookup(&block, word.as_bytes());
+        assert!(found);
+        total_reads += reads;
+        total_bytes += bytes;
+        max_reads = max_reads.max(reads);
+        max_bytes = max_bytes.max(bytes);
+    }
+    println!(
+        "Word list: {} words, {} nodes, {} bytes; reads per word: {:.2} avg, {} max; bytes read per word: {:.2} avg, {} max",
+        words.len(),
+        layout.order.len(),
+        block.len(),
+        total_reads as f64 / words.len() as f64,
+        max_reads,
+        total_bytes as f64 / words.len() as f64,
+        max_bytes
+    );
+    block
+}
+
+#[test]
+fn test_lookup() {
+    let words: Vec<String> = ["run", "running", "runs", "ran", "tap", "taps", "top", "tops", "Tapping", "it's", "x-ray"]
+        .iter()
+        .map(|w| w.to_string())
+        .collect();
+    let block = generate(&words);
+    for word in &words {
+        assert!(lookup(&block, word.to_ascii_lowercase().as_bytes()).0, "{}", word);
+    }
+    for word in ["runn", "r", "", "tappings", "tip", "xray", "its"] {
+        assert!(!lookup(&block, word.as_bytes()).0, "{}", word);
+    }
+    // The suffixes are shared
+    let dafsa = Dafsa::new(&["taps".to_string(), "tops".to_string()]);
+    let t = &dafsa.nodes[dafsa.nodes[0].edges[0].1];
+    assert_eq!(t.edges[0].1, t.edges[1].1);
+}
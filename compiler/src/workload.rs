@@ -0,0 +1,511 @@
+//! Turns plain text into stroke logs for replaying through the firmware's host build. Words are mapped back to
+//! strokes through the dictionary, preferring the shortest outlines and phrase briefs, with some inflected words
+//! stroked as word + suffix so that the orthography is exercised, and occasional misstrokes corrected with `*`.
+//! Stroke logs (generated or recorded) can also be scored against the dictionary, for laying it out by usage.
+use std::collections::{BTreeMap, HashMap, HashSet};
+use std::fmt::{self, Display, Formatter};
+
+use crate::dict::{Dict, JsonDict};
+use crate::orthography;
+use crate::regex_ortho;
+use crate::stroke::{Stroke, Strokes};
+
+/// Longest phrase brief (in words) that is looked for in the text
+const MAX_PHRASE_WORDS: usize = 4;
+const STAR: &str = "*";
+const NUMBER_BAR: u32 = 1 << 22;
+const STAR_BIT: u32 = 1 << 12;
+
+/// xorshift64*, so that the same seed always gives the same workload
+struct Rng(u64);
+
+impl Rng {
+    fn new(seed: u64) -> Self {
+        Rng(seed.wrapping_mul(0x9E37_79B9_7F4A_7C15) | 1)
+    }
+
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+
+    fn chance(&mut self, p: f64) -> bool {
+        ((self.next() >> 11) as f64 / (1u64 << 53) as f64) < p
+    }
+
+    fn below(&mut self, n: usize) -> usize {
+        (self.next() % n as u64) as usize
+    }
+}
+
+pub struct Options {
+    pub seed: u64,
+    /// Chance of a word having one of its strokes misstroked and undone
+    pub misstroke_rate: f64,
+    /// Chance of an inflected word being stroked as word + suffix even if it has its own entry
+    pub suffix_rate: f64,
+    pub wpm: u32,
+}
+
+#[derive(Default)]
+pub struct Stats {
+    wpm: u32,
+    words: usize,
+    strokes: usize,
+    single: usize,
+    multi: usize,
+    phrases: usize,
+    suffixed: usize,
+    fingerspelled: usize,
+    punctuation: usize,
+    misstrokes: usize,
+    dropped: usize,
+}
+
+impl Display for Stats {
+    fn fmt(&self, f: &mut Formatter) -> fmt::Result {
+        writeln!(
+            f,
+            "Words: {} ({} single stroke, {} multi stroke, {} in phrase briefs, {} with suffix strokes, {} fingerspelled, {} dropped)",
+            self.words, self.single, self.multi, self.phrases, self.suffixed, self.fingerspelled, self.dropped
+        )?;
+        writeln!(
+            f,
+            "Strokes: {} ({:.2} per word), including {} punctuation, {} misstrokes and as many undos",
+            self.strokes,
+            self.strokes as f64 / self.words.max(1) as f64,
+            self.punctuation,
+            self.misstrokes
+        )?;
+        let strokes_per_sec = self.wpm as f64 / 60.0 * self.strokes as f64 / self.words.max(1) as f64;
+        write!(
+            f,
+            "At {} WPM: {:.1} strokes/s, {:.1}ms per stroke",
+            self.wpm,
+            strokes_per_sec,
+            1000.0 / strokes_per_sec
+        )
+    }
+}
+
+/// Outline (strokes joined by `/`) ordering: fewer strokes, then fewer keys, then alphabetical to be stable
+fn outline_key(outline: &str) -> (usize, usize, &str) {
+    let strokes = outline.split('/').count();
+    let keys = outline.chars().filter(|&c| c != '/' && c != '-').count();
+    (strokes, keys, outline)
+}
+
+fn insert_shortest(map: &mut HashMap<String, String>, text: String, outline: &str) {
+    match map.get(&text) {
+        Some(old) if outline_key(old) <= outline_key(outline) => {}
+        _ => {
+            map.insert(text, outline.to_string());
+        }
+    }
+}
+
+/// Inner text of a `{^...}` suffix entry, if it is one
+fn suffix_text(entry: &str) -> Option<&str> {
+    let inner = entry.strip_prefix("{^")?.strip_suffix('}')?;
+    if !inner.is_empty() && inner.chars().all(|c| c.is_ascii_alphabetic()) {
+        Some(inner)
+    } else {
+        None
+    }
+}
+
+fn is_plain(entry: &str) -> bool {
+    !entry.is_empty()
+        && entry
+            .chars()
+            .all(|c| c.is_alphanumeric() || c == ' ' || c == '\'' || c == '-')
+        && !entry.starts_with(' ')
+        && !entry.ends_with(' ')
+}
+
+/// Reverse mapping from text to the best outline for it
+struct Outlines {
+    words: HashMap<String, String>,
+    suffixes: Vec<(String, String)>,
+    letters: HashMap<String, String>,
+    punctuation: HashMap<String, String>,
+    /// The orthography as the firmware has it, to check that a stem and a suffix type the word
+    regex_rules: Vec<u8>,
+    simple_rules: HashMap<(String, String), (usize, String)>,
+    /// Every outline in the dictionary, as a stem and a suffix stroked together can be another entry
+    taken: HashSet<String>,
+}
+
+impl Outlines {
+    fn new(dict: &JsonDict) -> Self {
+        let mut words = HashMap::new();
+        let mut suffixes = HashMap::new();
+        let mut letters = HashMap::new();
+        let mut punctuation = HashMap::new();
+        for (outline, entry) in dict {
+            if outline.split('/').any(|s| s.parse::<Stroke>().is_err()) {
+                continue;
+            }
+            if is_plain(entry) {
+                insert_shortest(&mut words, entry.clone(), outline);
+            } else if let Some(suffix) = suffix_text(entry) {
+                insert_shortest(&mut suffixes, suffix.to_string(), outline);
+            } else if let Some(inner) = entry.strip_prefix('{').and_then(|e| e.strip_suffix('}')) {
+                match inner.strip_prefix('&') {
+                    Some(letter) if letter.len() == 1 => insert_shortest(&mut letters, letter.to_string(), outline),
+                    None if inner.len() == 1 && ".,?!:;".contains(inner) => {
+                        insert_shortest(&mut punctuation, inner.to_string(), outline)
+                    }
+                    _ => {}
+                }
+            }
+        }
+        let mut suffixes: Vec<_> = suffixes.into_iter().collect();
+        // Longest suffix first, so that "ings" is tried before "s"
+        suffixes.sort_by(|(a, _), (b, _)| b.len().cmp(&a.len()).then(a.cmp(b)));
+        Outlines {
+            words,
+            suffixes,
+            letters,
+            punctuation,
+            regex_rules: regex_ortho::build().0,
+            simple_rules: orthography::rules(),
+            taken: dict.keys().cloned().collect(),
+        }
+    }
+
+    fn word(&self, text: &str, sentence_start: bool) -> Option<&String> {
+        let lower = text.to_lowercase();
+        // The firmware capitalizes the start of sentences by itself
+        if sentence_start {
+            self.words.get(&lower).or_else(|| self.words.get(text))
+        } else {
+            self.words.get(text).or_else(|| self.words.get(&lower))
+        }
+    }
+
+    /// What the firmware types for `word` followed by `suffix`: the regex rules on the last 7 characters, unless
+    /// their result isn't a word where the plain join is, then the simple rules, then the plain join
+    fn join(&self, word: &str, suffix: &str) -> String {
+        let end = &word[word.len().saturating_sub(7)..];
+        let plain = format!("{}{}", word, suffix);
+        if let Some((back, output)) = regex_ortho::apply(&self.regex_rules, end, suffix) {
+            let result = format!("{}{}", &word[..word.len() - back], output);
+            if self.words.contains_key(&result) || !self.words.contains_key(&plain) {
+                return result;
+            }
+        }
+        match self.simple_rules.get(&(end.to_string(), suffix.to_string())) {
+            Some((back, extra)) => format!("{}{}", &word[..word.len() - back], extra),
+            None => plain,
+        }
+    }
+
+    /// Split an inflected word into the outline of its stem and a suffix stroke, undoing the common spelling
+    /// changes that the orthography rules make (dropped `e`, doubled consonant, `y` to `i`). Only splits that type
+    /// the word again through the orthography, and whose strokes aren't another entry together, are taken
+    fn decompose(&self, word: &str) -> Option<(&String, &String)> {
+        let word = word.to_lowercase();
+        if !word.is_ascii() {
+            return None;
+        }
+        for (suffix, suffix_outline) in &self.suffixes {
+            let stem = match word.strip_suffix(&suffix[..]) {
+                Some(stem) if stem.len() > 1 => stem,
+                _ => continue,
+            };
+            let mut candidates = vec![stem.to_string(), format!("{}e", stem)];
+            let bytes = stem.as_bytes();
+            if bytes.len() > 2 && bytes[bytes.len() - 1] == bytes[bytes.len() - 2] {
+                candidates.push(stem[..stem.len() - 1].to_string());
+            }
+            if let Some(s) = stem.strip_suffix('i') {
+                candidates.push(format!("{}y", s));
+            }
+            if suffix == "s" {
+                if let Some(s) = stem.strip_suffix("ie") {
+                    candidates.push(format!("{}y", s));
+                } else if let Some(s) = stem.strip_suffix('e') {
+                    candidates.push(s.to_string());
+                }
+            }
+            let outline = candidates
+                .iter()
+                .filter(|c| **c != word && self.join(c, suffix) == word)
+                .filter_map(|c| self.words.get(c))
+                .find(|outline| !self.taken.contains(&format!("{}/{}", outline, suffix_outline)));
+            if let Some(outline) = outline {
+                return Some((outline, suffix_outline));
+            }
+        }
+        None
+    }
+
+    fn fingerspell(&self, word: &str) -> Option<Vec<&String>> {
+        word.chars()
+            .map(|c| self.letters.get(&c.to_ascii_lowercase().to_string()))
+            .collect()
+    }
+}
+
+/// Replace one of the strokes with a stroke one key off, followed by an undo
+fn misstroke(strokes: &mut Vec<String>, rng: &mut Rng) -> bool {
+    let pos = rng.below(strokes.len());
+    let stroke: Stroke = match strokes[pos].parse() {
+        Ok(s) => s,
+        Err(_) => return false,
+    };
+    // Number bar strokes print differently, so leave them alone
+    if stroke.raw() & NUMBER_BAR != 0 {
+        return false;
+    }
+    let bit = loop {
+        let bit = 1u32 << rng.below(22);
+        if bit != STAR_BIT {
+            break bit;
+        }
+    };
+    let wrong = Stroke(stroke.raw() ^ bit);
+    if wrong.raw() == 0 {
+        return false;
+    }
+    strokes.insert(pos, STAR.to_string());
+    strokes.insert(pos, wrong.to_string());
+    true
+}
+
+enum Token<'a> {
+    Word(&'a str),
+    Punctuation(char),
+}
+
+fn tokenize(corpus: &str) -> Vec<Token<'_>> {
+    let mut tokens = Vec::new();
+    for raw in corpus.split_whitespace() {
+        let start = raw.find(|c: char| c.is_alphanumeric()).unwrap_or(raw.len());
+        let end = raw
+            .rfind(|c: char| c.is_alphanumeric())
+            .map_or(start, |i| i + raw[i..].chars().next().unwrap().len_utf8());
+        tokens.extend(raw[..start].chars().map(Token::Punctuation));
+        if start < end {
+            tokens.push(Token::Word(&raw[start..end]));
+        }
+        tokens.extend(raw[end..].chars().map(Token::Punctuation));
+    }
+    tokens
+}
+
+/// Generate the stroke log for `corpus`, one line per word (or phrase brief), with strokes separated by `/`
+pub fn generate(dict: &JsonDict, corpus: &str, opts: &Options) -> (Vec<String>, Stats) {
+    let outlines = Outlines::new(dict);
+    let mut rng = Rng::new(opts.seed);
+    let mut stats = Stats {
+        wpm: opts.wpm,
+        ..Stats::default()
+    };
+    let mut lines = Vec::new();
+    let tokens = tokenize(corpus);
+    let mut sentence_start = true;
+    let mut i = 0;
+    while i < tokens.len() {
+        let word = match tokens[i] {
+            Token::Punctuation(p) => {
+                if let Some(outline) = outlines.punctuation.get(&p.to_string()) {
+                    lines.push(outline.clone());
+                    stats.punctuation += 1;
+                    stats.strokes += 1;
+                }
+                sentence_start = ".?!".contains(p);
+                i += 1;
+                continue;
+            }
+            Token::Word(w) => w,
+        };
+
+        // Longest phrase brief starting here
+        let phrase = (2..=MAX_PHRASE_WORDS).rev().find_map(|n| {
+            let words = tokens.get(i..i + n)?;
+            let words = words
+                .iter()
+                .map(|t| match t {
+                    Token::Word(w) => Some(*w),
+                    Token::Punctuation(_) => None,
+                })
+                .collect::<Option<Vec<_>>>()?;
+            outlines
+                .word(&words.join(" "), sentence_start)
+                .map(|o| (n, o))
+        });
+
+        let mut strokes: Vec<String>;
+        if let Some((n, outline)) = phrase {
+            strokes = outline.split('/').map(String::from).collect();
+            stats.phrases += n;
+            stats.words += n;
+            i += n;
+        } else {
+            let direct = outlines.word(word, sentence_start);
+            let split = if direct.is_none() || rng.chance(opts.suffix_rate) {
+                outlines.decompose(word)
+            } else {
+                None
+            };
+            if let Some((stem, suffix)) = split {
+                strokes = stem.split('/').chain(suffix.split('/')).map(String::from).collect();
+                stats.suffixed += 1;
+            } else if let Some(outline) = direct {
+                strokes = outline.split('/').map(String::from).collect();
+                if strokes.len() == 1 {
+                    stats.single += 1;
+                } else {
+                    stats.multi += 1;
+                }
+            } else if let Some(letters) = outlines.fingerspell(word) {
+                strokes = letters.into_iter().cloned().collect();
+                stats.fingerspelled += 1;
+            } else {
+                stats.dropped += 1;
+                i += 1;
+                continue;
+            }
+            stats.words += 1;
+            i += 1;
+        }
+
+        if rng.chance(opts.misstroke_rate) && misstroke(&mut strokes, &mut rng) {
+            stats.misstrokes += 1;
+        }
+        stats.strokes += strokes.len();
+        lines.push(strokes.join("/"));
+        sentence_start = false;
+    }
+    (lines, stats)
+}
+
+/// Counts how many times each entry is used in a stroke log, i.e. how many times it's the longest entry ending at a
+/// stroke, as the firmware would translate it. `*` takes back the last stroke. Strokes that don't parse are skipped
+pub fn usage_counts(dict: &Dict, log: &str) -> BTreeMap<Strokes, u32> {
+    let max_len = dict.0.keys().map(|s| s.len()).max().unwrap_or(0);
+    let mut counts = BTreeMap::new();
+    let mut history: Vec<Stroke> = vec![];
+    for token in log.split(|c: char| c.is_whitespace() || c == '/') {
+        if token == STAR {
+            history.pop();
+            continue;
+        }
+        match token.parse() {
+            Ok(stroke) => history.push(stroke),
+            Err(_) => continue,
+        }
+        let longest = (1..=max_len.min(history.len()))
+            .rev()
+            .map(|len| Strokes(history[history.len() - len..].to_vec()))
+            .find(|strokes| dict.0.contains_key(strokes));
+        if let Some(strokes) = longest {
+            *counts.entry(strokes).or_insert(0) += 1;
+        }
+    }
+    counts
+}
+
+#[cfg(test)]
+fn test_dict() -> JsonDict {
+    [
+        ("-T", "the"),
+        ("KAT", "cat"),
+        ("RUPB", "run"),
+        ("-G", "{^ing}"),
+        ("-S", "{^s}"),
+        ("TP-PL", "{.}"),
+        ("SRAOEUPB", "vine"),
+        ("A*", "{&a}"),
+        ("PW*", "{&b}"),
+        ("KAT/HRAOG", "catalogue"),
+        ("-FT", "of the"),
+    ]
+    .iter()
+    .map(|(k, v)| (k.to_string(), v.to_string()))
+    .collect()
+}
+
+#[test]
+fn test_generate() {
+    let opts = Options {
+        seed: 1,
+        misstroke_rate: 0.0,
+        suffix_rate: 0.0,
+        wpm: 240,
+    };
+    let (lines, stats) = generate(&test_dict(), "The cat running, of the vines. Catalogue ab", &opts);
+    assert_eq!(
+        lines,
+        vec!["-T", "KAT", "RUPB/-G", "-FT", "SRAOEUPB/-S", "TP-PL", "KAT/HRAOG", "A*/PW*"]
+    );
+    assert_eq!(stats.words, 8);
+    assert_eq!(stats.suffixed, 2);
+    assert_eq!(stats.dropped, 0);
+}
+
+#[test]
+fn test_split_types_word() {
+    let opts = Options {
+        seed: 1,
+        misstroke_rate: 0.0,
+        suffix_rate: 1.0,
+        wpm: 240,
+    };
+    let mut dict = test_dict();
+    for (outline, entry) in [
+        ("TPRAOE", "free"),
+        ("SEPBD", "send"),
+        ("WHEPB", "when"),
+        ("SAOEPB", "sene"),
+        ("WHAOE", "whee"),
+        ("-E", "{^e}"),
+        ("-D", "{^d}"),
+        ("-PB", "{^n}"),
+        ("KAT/-S", "Katz"),
+    ] {
+        dict.insert(outline.to_string(), entry.to_string());
+    }
+    // "free" + "e", "sene" + "d" and "whee" + "n" are stems and suffixes in the dictionary, but don't type them, and
+    // "cat" + "s" is stroked as another entry
+    let (lines, stats) = generate(&dict, "free send when sending running cats", &opts);
+    assert_eq!(lines, vec!["TPRAOE", "SEPBD", "WHEPB", "SEPBD/-G", "RUPB/-G"]);
+    assert_eq!(stats.suffixed, 2);
+    assert_eq!(stats.dropped, 1);
+}
+
+#[test]
+fn test_misstroke_reproducible() {
+    let opts = Options {
+        seed: 42,
+        misstroke_rate: 1.0,
+        suffix_rate: 0.0,
+        wpm: 240,
+    };
+    let (a, stats) = generate(&test_dict(), "the cat the cat", &opts);
+    let (b, _) = generate(&test_dict(), "the cat the cat", &opts);
+    assert_eq!(a, b);
+    assert_eq!(stats.misstrokes, 4);
+    for line in a {
+        let strokes: Vec<_> = line.split('/').collect();
+        assert_eq!(strokes.len(), 3);
+        assert_eq!(strokes[1], STAR);
+    }
+}
+
+#[test]
+fn test_usage_counts() {
+    let dict = Dict::parse(test_dict()).unwrap();
+    let counts = usage_counts(&dict, "-T KAT/HRAOG\nKAT -T/KAT TKPW *\nRUPB -G\n");
+    let parse = |s: &str| Strokes(s.split('/').map(|s| s.parse().unwrap()).collect());
+    assert_eq!(counts.get(&parse("-T")), Some(&2));
+    assert_eq!(counts.get(&parse("KAT")), Some(&3));
+    assert_eq!(counts.get(&parse("KAT/HRAOG")), Some(&1));
+    assert_eq!(counts.get(&parse("RUPB")), Some(&1));
+    assert_eq!(counts.get(&parse("-G")), Some(&1));
+    assert_eq!(counts.get(&parse("HRAOG")), None);
+}
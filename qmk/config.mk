@@ -7,6 +7,11 @@ STENO_NOMSD = no
 # Graphical stroke display for demos
 STENO_STROKE_DISPLAY = no
 STENO_NOUNICODE = yes
+# Lines in the RAM cache in front of flash reads, 32 bytes each (see `store_cache.c`); 0 to disable
+STENO_STORE_CACHE = 4
+# Milliseconds to hold back the output of a stroke that may become part of a longer entry with the next stroke, so
+# that it's not typed only to be erased when strokes come in quick succession; 0 to disable
+STENO_LOOKAHEAD = 0
 
 STENO_DEBUG = hist # stroke flash dicted
 STENO_FLASH_LOGGING = yes
@@ -45,10 +45,43 @@ static void dicted_prompt_trans(void) {
     entry_buf_len = 0;
 }
 
+// Where the bucket of the entry being edited is, for removing inline entries
+static uint32_t remove_bucket_addr;
+
 static bool add_entry(void) {
 #ifdef STENO_DEBUG_FLASH
     flash_debug_enable = 1;
 #endif
+    const uint32_t hash = hash_strokes(strokes, strokes_len);
+    const uint32_t bucket_addr = find_strokes_hash(strokes, strokes_len, hash, 1);
+    if (bucket_addr == -1) {
+        disp_show_nostorage();
+        editing_state = ED_ERROR;
+        return true;
+    }
+    attr_t attr = { .space_prev = 1, .space_after = 1, .glue = 0, .text = 1 };
+    const uint8_t displacement = ((bucket_addr - BUCKET_START) / BUCKET_SIZE - hash) & (BUCKET_NUM - 1);
+    const uint16_t tail = BUCKET_TAIL(hash, displacement);
+    bool inline_entry = strokes_len == 1 && entry_buf_len <= BUCKET_INLINE_SIZE;
+    uint32_t payload = *(const uint8_t *) &attr & 0x07;
+    for (uint8_t i = 0; i < entry_buf_len; i ++) {
+        inline_entry = inline_entry && entry_buf[i] != 0 && entry_buf[i] < 0x80;
+        if (entry_buf[i] < 32 || entry_buf[i] >= 127) {
+            attr.text = 0;
+        }
+        payload |= (uint32_t) (entry_buf[i] & 0x7F) << (3 + 7 * i);
+    }
+    if (inline_entry) {
+        const uint32_t bucket = (payload >> 16) << 24 | 0xF00000 | (payload & 0xFFFF) << 4 | 1;
+        store_write_direct(bucket_addr, (const uint8_t *const) &bucket, 4);
+        store_write_direct(bucket_addr + 4, (const uint8_t *const) &tail, 2);
+        ending_lens_add(strokes, strokes_len);
+        store_flush();
+#ifdef STENO_DEBUG_FLASH
+        flash_debug_enable = 0;
+#endif
+        return false;
+    }
     uint8_t bloq;
     const uint8_t entry_len = strokes_len * STROKE_SIZE + 1 + entry_buf_len;
     if (entry_len <= 16) {
@@ -67,16 +100,17 @@ static bool add_entry(void) {
         return true;
     }
     const uint32_t block_addr = block_ind * 16 + KVPAIR_BLOCK_START;
-    const attr_t attr = { .space_prev = 1, .space_after = 1, .glue = 0 };
 #ifdef STENO_DEBUG_DICTED
     steno_debug_ln("blok addr %06lX", block_addr);
 #endif
     store_write_direct(block_addr, (const uint8_t *const) strokes, strokes_len * STROKE_SIZE);
     store_write_direct(block_addr + strokes_len * STROKE_SIZE, (const uint8_t *const) &attr, 1);
     store_write_direct(block_addr + strokes_len * STROKE_SIZE + 1, entry_buf, entry_buf_len);
-    const uint32_t bucket_addr = find_strokes((uint8_t *) strokes, strokes_len, 1);
     const uint32_t bucket = (uint32_t) entry_buf_len << 24 | ((block_addr - KVPAIR_BLOCK_START) & 0xFFFFF0) | (strokes_len & 0x0F);
-    store_write_direct(bucket_addr, (const uint8_t *const) &bucket, BUCKET_SIZE);
+    store_write_direct(bucket_addr, (const uint8_t *const) &bucket, 4);
+    store_write_direct(bucket_addr + 4, (const uint8_t *const) &tail, 2);
+    suffix_filter_add(strokes, strokes_len);
+    ending_lens_add(strokes, strokes_len);
     store_flush();
 #ifdef STENO_DEBUG_FLASH
     flash_debug_enable = 0;
@@ -88,6 +122,22 @@ static void remove_entry(const uint32_t bucket) {
 #ifdef STENO_DEBUG_FLASH
     flash_debug_enable = 1;
 #endif
+    if (BUCKET_IS_INLINE(bucket)) {
+        // Clearing the stroke count marks it removed. It then stops searches like any other bucket, but entries added
+        // since can be displaced further past it, as inline buckets never raise their displacement. Clearing the
+        // displacement bits to the largest displacement keeps them reachable
+        const uint32_t removed = 0;
+        store_write_direct(remove_bucket_addr, (const uint8_t *const) &removed, 4);
+        uint16_t tail;
+        store_read_uncached(remove_bucket_addr + 4, (uint8_t *) &tail, 2);
+        tail &= 0xFFF0;
+        store_write_direct(remove_bucket_addr + 4, (const uint8_t *const) &tail, 2);
+        store_flush();
+#ifdef STENO_DEBUG_FLASH
+        flash_debug_enable = 0;
+#endif
+        return;
+    }
     const uint32_t last_entry_addr = BUCKET_GET_ADDR(bucket);
     const uint8_t kvpair_len = BUCKET_GET_ENTRY_LEN(bucket) + 1 + BUCKET_GET_STROKES_LEN(bucket) * STROKE_SIZE;
     store_erase_partial(last_entry_addr, kvpair_len);
@@ -117,12 +167,15 @@ static uint32_t dicted_conf_entry(void) {
         dicted_prompt_trans();
         return 0;
     }
-    read_entry(bucket, kvpair_buf);
+    remove_bucket_addr = found_bucket_addr;
     const uint8_t entry_len = BUCKET_GET_ENTRY_LEN(bucket);
-    const uint8_t stroke_byte_len = STROKE_SIZE * strokes_len;
     char entry_trans[entry_len + 1];
 
-    memcpy(entry_trans, kvpair_buf + stroke_byte_len + 1, entry_len);
+    entry_cursor_t cur;
+    entry_open(&cur, bucket);
+    for (uint8_t i = 0; i < entry_len; i ++) {
+        entry_trans[i] = entry_next(&cur);
+    }
     entry_trans[entry_len] = 0;
     disp_conf_entry(entry_trans);
     return bucket;
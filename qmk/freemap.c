@@ -59,7 +59,7 @@ static uint8_t _req(const uint8_t lvl, const uint32_t word, const uint8_t block,
 uint32_t freemap_req(uint8_t block) {
     uint32_t ind;
     _req(3, 0, block, &ind);
-    if (ind < (FREEMAP_START - KVPAIR_BLOCK_START)) {
+    if (ind < (SUFFIX_FILTER_START - KVPAIR_BLOCK_START) / 16) {
         return ind;
     } else {
         return -1;
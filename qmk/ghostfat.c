@@ -71,6 +71,16 @@ void padded_memcpy(char *dst, char const *src, const int len) {
     }
 }
 
+// Where the ongoing read of the file would carry on from, if any
+static uint32_t fat_read_addr = 0xFFFFFFFF;
+
+void fat_read_done(void) {
+    if (fat_read_addr != 0xFFFFFFFF) {
+        store_read_end();
+        fat_read_addr = 0xFFFFFFFF;
+    }
+}
+
 // `data` will be packet sized
 void fat_read_block(const uint32_t block_no, const uint8_t packet_num, uint8_t *const data) {
     uint32_t cluster_no = block_no / BLOCKS_PER_CLUSTER;
@@ -134,6 +144,13 @@ void fat_read_block(const uint32_t block_no, const uint8_t packet_num, uint8_t *
         }
     } else if (cluster_no < FILE_END) {
         cluster_no -= FILE_START;
-        store_read((cluster_no * PACKETS_PER_CLUSTER + cluster_packet_num) * EPSIZE, data, EPSIZE);
+        // Packets of the file are usually read one after another, so the read carries on from the last one
+        const uint32_t addr = (cluster_no * PACKETS_PER_CLUSTER + cluster_packet_num) * EPSIZE;
+        if (addr != fat_read_addr) {
+            fat_read_done();
+            store_read_begin(addr);
+        }
+        store_read_next(data, EPSIZE);
+        fat_read_addr = addr + EPSIZE;
     }
 }
@@ -0,0 +1,178 @@
+// Output queue of key taps, filled by the translation of a stroke and drained to the host by `hid_out_task` from the
+// main loop, one report at a time whenever the host has polled the last one, so that the next stroke can be looked up
+// while the last one is still being typed. Instead of a press report and a release report for every key, the taps
+// are packed into reports of up to 6 keys each: the host types the keys newly pressed in a report in the order they
+// appear in it, so a run of distinct keys under the same modifiers goes out in one report. A key that's already down
+// has to be released before it can be typed again, and so does a change of modifiers, which costs a release report;
+// otherwise the next run replaces the keys of the last one directly.
+//
+// A backspace over a character still in the queue takes it out instead of being queued. With `hid_out_hold`, the
+// engine can keep the output of a stroke that may yet become part of a longer entry from being sent for a while, so
+// that when the next stroke does replace it, it's never typed in the first place
+#include <string.h>
+#include "hid_out.h"
+#include "steno.h"
+#include "process_keycode/process_unicode_common.h"
+
+#define HID_OUT_SIZE 64
+#define HID_OUT_MASK (HID_OUT_SIZE - 1)
+#define HID_OUT_KEYS 6
+// Not a key: the code point of a Unicode character is in `mods` of this tap (bits 16-20) and the next (bits 0-15)
+#define HID_OUT_UNICODE 0xFF
+
+typedef struct {
+    uint8_t keycode;
+    uint8_t mods;
+} tap_t;
+
+static tap_t queue[HID_OUT_SIZE];
+static uint8_t queue_head = 0, queue_tail = 0;
+// Number of taps at the end of the queue that are characters, which a backspace can take out
+static uint8_t queue_chars = 0;
+// Keys and modifiers down as of the last report sent
+static uint8_t down[HID_OUT_KEYS], down_len = 0, down_mods = 0;
+static uint16_t hold_start = 0, hold_ms = 0;
+
+static uint8_t queue_len(void) {
+    return (queue_tail - queue_head) & HID_OUT_MASK;
+}
+
+// Makes room for `len` taps, sending out what's held back if needed
+static void queue_wait(const uint8_t len) {
+    if (HID_OUT_SIZE - 1 - queue_len() < len) {
+        hold_ms = 0;
+        while (HID_OUT_SIZE - 1 - queue_len() < len) {
+            hid_out_task();
+        }
+    }
+}
+
+static void queue_push(const uint8_t keycode, const uint8_t mods) {
+    queue[queue_tail].keycode = keycode;
+    queue[queue_tail].mods = mods;
+    queue_tail = (queue_tail + 1) & HID_OUT_MASK;
+}
+
+void hid_out_tap(const uint8_t keycode, const uint8_t mods) {
+    if (keycode == KC_BSPC && !mods && queue_chars) {
+        queue_tail = (queue_tail - 1) & HID_OUT_MASK;
+        queue_chars --;
+        return;
+    }
+    queue_wait(1);
+    queue_push(keycode, mods);
+    queue_chars = 0;
+}
+
+void hid_out_char(const char c) {
+    const uint8_t ascii = c;
+    uint8_t mods = 0;
+    if (PGM_LOADBIT(ascii_to_shift_lut, ascii)) {
+        mods |= MOD_BIT(KC_LSFT);
+    }
+    if (PGM_LOADBIT(ascii_to_altgr_lut, ascii)) {
+        mods |= MOD_BIT(KC_RALT);
+    }
+    queue_wait(1);
+    queue_push(pgm_read_byte(&ascii_to_keycode_lut[ascii]), mods);
+    queue_chars ++;
+}
+
+void hid_out_unicode(const uint32_t code_point) {
+    queue_wait(2);
+    queue_push(HID_OUT_UNICODE, code_point >> 16);
+    queue_push(code_point & 0xFF, (code_point >> 8) & 0xFF);
+    queue_chars = 0;
+}
+
+void hid_out_hold(const uint16_t ms) {
+    hold_start = timer_read();
+    hold_ms = ms;
+}
+
+static void hid_out_send(const uint8_t mods, const uint8_t *const keys, const uint8_t len) {
+    clear_keys();
+    clear_weak_mods();
+    add_weak_mods(mods);
+    for (uint8_t i = 0; i < len; i ++) {
+        add_key(keys[i]);
+    }
+    send_keyboard_report();
+    memcpy(down, keys, len);
+    down_len = len;
+    down_mods = mods;
+}
+
+bool hid_out_task(void) {
+    if (!hid_out_ready()) {
+        return false;
+    }
+    if (hold_ms && timer_elapsed(hold_start) >= hold_ms) {
+        hold_ms = 0;
+    }
+    const bool any_down = down_len || down_mods;
+    if (queue_head == queue_tail || hold_ms) {
+        if (any_down) {
+            hid_out_send(0, NULL, 0);
+            return true;
+        }
+        return false;
+    }
+
+    const tap_t *const first = &queue[queue_head];
+    if (first->keycode == HID_OUT_UNICODE) {
+        if (any_down) {
+            hid_out_send(0, NULL, 0);
+            return true;
+        }
+        const tap_t *const next = &queue[(queue_head + 1) & HID_OUT_MASK];
+        queue_head = (queue_head + 2) & HID_OUT_MASK;
+        // Typed with a sequence of its own, which waits for the host as it goes
+        register_unicode((uint32_t) first->mods << 16 | (uint16_t) next->mods << 8 | next->keycode);
+        return true;
+    }
+
+    const uint8_t mods = first->mods;
+    uint8_t keys[HID_OUT_KEYS], len = 0;
+    uint8_t i = queue_head;
+    if (first->keycode == 0) {
+        i = (i + 1) & HID_OUT_MASK;
+    } else {
+        for (; i != queue_tail && len < HID_OUT_KEYS; i = (i + 1) & HID_OUT_MASK) {
+            const uint8_t keycode = queue[i].keycode;
+            if (keycode == 0 || keycode == HID_OUT_UNICODE || queue[i].mods != mods || memchr(keys, keycode, len)) {
+                break;
+            }
+#ifdef NKRO_ENABLE
+            // The NKRO report is a bitmap, which the host reads in keycode order
+            if (keymap_config.nkro && len && keycode < keys[len - 1]) {
+                break;
+            }
+#endif
+            keys[len ++] = keycode;
+        }
+    }
+
+    // Taps of just the modifiers are kept apart by releases, as are reports over the same keys or other modifiers
+    bool release = down_len == 0 || len == 0 || down_mods != mods;
+    for (uint8_t j = 0; j < len && !release; j ++) {
+        release = memchr(down, keys[j], down_len) != NULL;
+    }
+    if (release && any_down) {
+        hid_out_send(0, NULL, 0);
+        return true;
+    }
+    hid_out_send(mods, keys, len);
+    queue_head = i;
+    if (queue_chars > queue_len()) {
+        queue_chars = queue_len();
+    }
+    return true;
+}
+
+void hid_out_flush(void) {
+    hold_ms = 0;
+    while (queue_head != queue_tail || down_len || down_mods) {
+        hid_out_task();
+    }
+}
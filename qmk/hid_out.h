@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Queues a tap of `keycode` with the modifiers `mods` (as in `MOD_BIT`) held; keycode 0 taps just the modifiers.
+// Waits for the queue to drain if it's full. A backspace takes out the last character queued if it's not sent yet
+void hid_out_tap(uint8_t keycode, uint8_t mods);
+// Queues the keys that type the ASCII character `c`
+void hid_out_char(char c);
+// Queues a Unicode character, typed with `register_unicode` once the keys before it are out
+void hid_out_unicode(uint32_t code_point);
+// Keeps what's queued so far from being sent for up to `ms` milliseconds, or until the next call
+void hid_out_hold(uint16_t ms);
+// Sends the next report out of the queue if the host is ready for it and nothing's held, to be called from the main
+// loop; whether a report was sent
+bool hid_out_task(void);
+// Sends everything queued, held or not, and releases all keys, waiting for the host
+void hid_out_flush(void);
+// Whether the host has taken the last report sent, so that the next one doesn't have to wait; from the HID hooks
+bool hid_out_ready(void);
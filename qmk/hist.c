@@ -5,6 +5,7 @@
 #include <stdio.h>
 
 #include "hist.h"
+#include "hid_out.h"
 #include "steno.h"
 #include "store.h"
 #include "process_keycode/process_unicode_common.h"
@@ -17,6 +18,8 @@
 #endif
 
 static history_t history[HIST_SIZE];
+bool toggle_star = false;
+bool repeat_stroke = false;
 
 extern char last_trans[128];
 extern uint8_t last_trans_size;
@@ -33,9 +36,61 @@ static void dict_edit_puts(const char *const str) {
 }
 #endif
 
+// The last characters typed out, and the backspaces over them that aren't sent yet. Characters that are typed again
+// in the same place as the ones being erased take back a backspace instead of being sent, so that replacing an
+// output only erases and retypes the part after what the old and new outputs have in common.
+#define TYPED_SIZE 64
+#define TYPED_MASK (TYPED_SIZE - 1)
+static char typed[TYPED_SIZE];
+static uint8_t typed_end = 0, typed_len = 0;
+static uint8_t back_pending = 0;
+
+void steno_flush_back(void) {
+    for (; back_pending > 0; back_pending --) {
+        hid_out_tap(KC_BSPC, 0);
+        if (typed_len) {
+            typed_end = (typed_end - 1) & TYPED_MASK;
+            typed_len --;
+        }
+    }
+}
+
+// The output of the last history entries, as sent by `process_output`: bytes under 32 are that many backspaces, and
+// the rest are characters. Undoing an entry that replaced earlier ones retypes these from here instead of reading
+// and processing their entries again. Output that can't be retyped this way (key codes, Unicode, commands and
+// anything during dictionary editing) isn't recorded
+#define HIST_OUT_SIZE 128
+#define HIST_OUT_MASK (HIST_OUT_SIZE - 1)
+#define HIST_OUT_NONE 0xFF
+static char hist_out[HIST_OUT_SIZE];
+static uint16_t hist_out_pos = 0, hist_out_start = 0;
+// Depth of `process_output` calls, of which only the outermost one records
+static uint8_t out_depth = 0;
+static bool out_recording = false;
+
+static void hist_out_put(const char c) {
+    if (!out_depth || !out_recording) {
+        return;
+    }
+    if ((uint16_t) (hist_out_pos - hist_out_start) >= HIST_OUT_SIZE) {
+        out_recording = false;
+        return;
+    }
+    hist_out[hist_out_pos & HIST_OUT_MASK] = c;
+    hist_out_pos ++;
+}
+
+// For output that isn't kept track of, after which the backspaces can't be matched any more
+static void steno_forget_typed(void) {
+    steno_flush_back();
+    typed_len = 0;
+    out_recording = false;
+}
+
 static void steno_back(const uint8_t len) {
 #ifndef STENO_READONLY
     if (editing_state != ED_IDLE) {
+        out_recording = false;
         if (entry_buf_len > len) {
             disp_trans_edit_back(len);
             entry_buf_len -= len;
@@ -46,8 +101,14 @@ static void steno_back(const uint8_t len) {
     } else
 #endif
     {
-        for (uint8_t i = 0; i < len; i ++) {
-            tap_code(KC_BSPC);
+        if (back_pending + len > 255) {
+            steno_flush_back();
+        }
+        back_pending += len;
+        for (uint8_t left = len; left > 0; ) {
+            const uint8_t run = left < 31 ? left : 31;
+            hist_out_put(run);
+            left -= run;
         }
     }
 }
@@ -55,6 +116,7 @@ static void steno_back(const uint8_t len) {
 static void steno_send_char(const char c) {
 #ifndef STENO_READONLY
     if (editing_state != ED_IDLE) {
+        out_recording = false;
         if (entry_buf_len < 255) {
             entry_buf[entry_buf_len ++] = c;
             disp_trans_edit_handle_char(c);
@@ -65,13 +127,93 @@ static void steno_send_char(const char c) {
         if (last_trans_size < 128) {
             last_trans[last_trans_size++] = c;
         }
-        send_char(c);
+        hist_out_put(c);
+        if (back_pending && back_pending <= typed_len && typed[(typed_end - back_pending) & TYPED_MASK] == c) {
+            back_pending --;
+        } else {
+            steno_flush_back();
+            hid_out_char(c);
+            typed[typed_end] = c;
+            typed_end = (typed_end + 1) & TYPED_MASK;
+            if (typed_len < TYPED_SIZE) {
+                typed_len ++;
+            }
+        }
     }
 #ifdef STENO_DEBUG_HIST
     steno_debug("%c", c);
 #endif
 }
 
+// Sends the characters of a run as `steno_send_char` would one at a time, but in one go after the ones that are
+// typed already
+static void steno_send_run(const char *const str, const uint8_t len) {
+#ifndef STENO_READONLY
+    if (editing_state != ED_IDLE) {
+        for (uint8_t i = 0; i < len; i ++) {
+            steno_send_char(str[i]);
+        }
+        return;
+    }
+#endif
+    const uint8_t trans_len = len < 128 - last_trans_size ? len : 128 - last_trans_size;
+    memcpy(last_trans + last_trans_size, str, trans_len);
+    last_trans_size += trans_len;
+    uint8_t i = 0;
+    for (; i < len && back_pending && back_pending <= typed_len
+            && typed[(typed_end - back_pending) & TYPED_MASK] == str[i]; i ++) {
+        hist_out_put(str[i]);
+        back_pending --;
+    }
+    if (i < len) {
+        steno_flush_back();
+        typed_len = typed_len + (len - i) < TYPED_SIZE ? typed_len + (len - i) : TYPED_SIZE;
+    }
+    for (; i < len; i ++) {
+        hist_out_put(str[i]);
+        hid_out_char(str[i]);
+        typed[typed_end] = str[i];
+        typed_end = (typed_end + 1) & TYPED_MASK;
+    }
+#ifdef STENO_DEBUG_HIST
+    for (uint8_t i = 0; i < len; i ++) {
+        steno_debug("%c", str[i]);
+    }
+#endif
+}
+
+// Sends a character in the case `cap`; the case for the next one
+static uint8_t steno_send_cased(const char c, const uint8_t cap) {
+    switch (cap) {
+    case CAPS_LOWER:
+        steno_send_char(tolower(c));
+        return c == ' ' ? CAPS_NORMAL : cap;
+    case CAPS_CAP:
+        steno_send_char(toupper(c));
+        return CAPS_NORMAL;
+    case CAPS_UPPER:
+        steno_send_char(toupper(c));
+        return c == ' ' ? CAPS_NORMAL : cap;
+    default:
+        steno_send_char(c);
+        return cap;
+    }
+}
+
+// Sends the next `len` bytes of the entry as text, a window at a time, with only the first character or word left to
+// be cased; the case for what's after
+static uint8_t steno_send_text(entry_cursor_t *const cur, uint8_t len, uint8_t cap) {
+    const uint8_t *run;
+    for (uint8_t run_len; len && (run_len = entry_next_run(cur, &run, len)); len -= run_len) {
+        uint8_t i = 0;
+        for (; i < run_len && cap != CAPS_NORMAL; i ++) {
+            cap = steno_send_cased(run[i], cap);
+        }
+        steno_send_run((const char *) run + i, run_len - i);
+    }
+    return cap;
+}
+
 #ifndef STENO_NOUNICODE
 static uint8_t steno_send_unicode(const uint32_t u) {
 #ifdef STENO_DEBUG_HIST
@@ -102,17 +244,34 @@ static uint8_t steno_send_unicode(const uint32_t u) {
                 last_trans[last_trans_size++] = buf[i];
             }
         }
-        register_unicode(u);
+        steno_forget_typed();
+        hid_out_unicode(u);
         return 1;
     }
 }
 #endif
 
-static uint8_t steno_send_keycodes(const uint8_t *const keycodes, const uint8_t len) {
+// Reads the rest of the UTF-8 character starting with `c` from the entry, moving `i` on to its last byte; its code point
+static int32_t entry_next_utf8(entry_cursor_t *const cur, const uint8_t c, uint8_t *const i) {
+    const uint8_t len = (c & 0xF8) == 0xF0 ? 4 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xE0) == 0xC0 ? 2 : 1;
+    char buf[4] = {c};
+    for (uint8_t j = 1; j < len; j ++) {
+        buf[j] = entry_next(cur);
+    }
+    *i += len - 1;
+    int32_t code_point = 0;
+    decode_utf8(buf, &code_point);
+    return code_point;
+}
+
+// Sends the next `len` bytes of the entry as key codes
+static uint8_t steno_send_keycodes(entry_cursor_t *const cur, const uint8_t len) {
 #ifdef STENO_DEBUG_HIST
     steno_debug("keys(%u):", len);
 #endif
-    uint8_t mods = 0;
+    // Modifiers held, and those pressed without a key tapped under them yet, which are then tapped on their own
+    uint8_t mods = 0, bare_mods = 0;
+    out_recording = false;
 #ifndef STENO_READONLY
     char buf[16];
     uint8_t output_len = 3;
@@ -121,8 +280,9 @@ static uint8_t steno_send_keycodes(const uint8_t *const keycodes, const uint8_t
     }
 #endif
     for (uint8_t i = 0; i < len; i++) {
-        if ((keycodes[i] & 0xF8) == 0xE0) {
-            const uint8_t mod = keycodes[i] & 0x07;
+        const uint8_t keycode = entry_next(cur);
+        if ((keycode & 0xF8) == 0xE0) {
+            const uint8_t mod = keycode & 0x07;
 #if defined(STENO_DEBUG_HIST) || !defined(STENO_READONLY)
             uint8_t mod_char;
             switch (mod & 3) {
@@ -141,7 +301,10 @@ static uint8_t steno_send_keycodes(const uint8_t *const keycodes, const uint8_t
                 } else
 #endif
                 {
-                    unregister_code(keycodes[i]);
+                    if (bare_mods & mod_mask) {
+                        hid_out_tap(0, mods);
+                    }
+                    bare_mods = 0;
                 }
 #ifdef STENO_DEBUG_HIST
                 steno_debug(" %c", mod_char);
@@ -155,7 +318,8 @@ static uint8_t steno_send_keycodes(const uint8_t *const keycodes, const uint8_t
                 } else
 #endif
                 {
-                    register_code(keycodes[i]);
+                    steno_forget_typed();
+                    bare_mods |= mod_mask;
                 }
 #ifdef STENO_DEBUG_HIST
                 steno_debug(" %c", toupper(mod_char));
@@ -164,17 +328,19 @@ static uint8_t steno_send_keycodes(const uint8_t *const keycodes, const uint8_t
             mods ^= mod_mask;
         } else {
 #ifdef STENO_DEBUG_HIST
-            steno_debug(" %02X", keycodes[i]);
+            steno_debug(" %02X", keycode);
 #endif
 #ifndef STENO_READONLY
             if (editing_state != ED_IDLE) {
-                snprintf(buf, 16, " %02X", keycodes[i]);
+                snprintf(buf, 16, " %02X", keycode);
                 dict_edit_puts(buf);
                 output_len += 3;
             } else
 #endif
             {
-                tap_code(keycodes[i]);
+                steno_forget_typed();
+                hid_out_tap(keycode, mods);
+                bare_mods = 0;
             }
         }
     }
@@ -196,6 +362,299 @@ inline history_t *hist_get(const uint8_t ind) {
     return &history[ind];
 }
 
+// Number of entries before the current one in `history`
+static uint8_t hist_depth = 0;
+
+// The entries older than the ones in `history`, packed one after another in a stack: the length of the output, the
+// bucket, or the stroke for a raw one, or both for an inline entry with only the payload of the bucket, the
+// orthography length if it's not the number of strokes, and the end of the word if it doesn't come from the entry,
+// followed by its length, and then a byte of flags last so that the stack can be popped from the top. The stroke of
+// an entry in the dictionary is the last of its strokes there, so it's read back from the entry instead of kept. The
+// lookup state and output record of an entry don't survive being packed: all the prefixes are searched after it
+// when it's back, and its output is processed again if it has to be retyped. When the stack is full, the oldest
+// entries are dropped to free an eighth of it at once
+#define HIST_PACKED_SIZE 192
+#define HIST_PACKED_FREE (HIST_PACKED_SIZE / 8)
+#define PACKED_RAW 0x01
+#define PACKED_STATE_SHIFT 1
+#define PACKED_ORTHO_LEN 0x20
+#define PACKED_END 0x40
+#define PACKED_INLINE 0x80
+static uint8_t packed[HIST_PACKED_SIZE];
+static uint16_t packed_top = 0;
+static uint8_t packed_num = 0;
+
+// Size of the packed entry ending at `top`
+static uint8_t packed_size(const uint16_t top) {
+    const uint8_t flags = packed[top - 1];
+    const uint8_t entry_size = flags & PACKED_RAW ? STROKE_SIZE
+        : flags & PACKED_INLINE ? STROKE_SIZE + BUCKET_INLINE_SIZE : 4;
+    return 1 + entry_size + (flags & PACKED_ORTHO_LEN ? 1 : 0) + (flags & PACKED_END ? packed[top - 2] + 1 : 0) + 1;
+}
+
+static void hist_pack(const history_t *const hist) {
+    uint8_t buf[1 + STROKE_SIZE + BUCKET_INLINE_SIZE + 1 + 7 + 1 + 1];
+    uint8_t len = 0, flags = 0;
+    buf[len ++] = hist->len;
+    const uint32_t bucket = hist->bucket;
+    const uint8_t strokes_len = BUCKET_GET_STROKES_LEN(bucket);
+    if (bucket == 0 || BUCKET_IS_INLINE(bucket)) {
+        const uint32_t stroke = hist->stroke;
+        memcpy(buf + len, &stroke, STROKE_SIZE);
+        len += STROKE_SIZE;
+        if (bucket == 0) {
+            flags |= PACKED_RAW;
+        } else {
+            flags |= PACKED_INLINE;
+            const uint32_t payload = BUCKET_INLINE_PAYLOAD(bucket);
+            memcpy(buf + len, &payload, BUCKET_INLINE_SIZE);
+            len += BUCKET_INLINE_SIZE;
+        }
+    } else {
+        memcpy(buf + len, &bucket, 4);
+        len += 4;
+    }
+    if (hist->ortho_len != (strokes_len ? strokes_len : 1)) {
+        flags |= PACKED_ORTHO_LEN;
+        buf[len ++] = hist->ortho_len;
+    }
+    if (hist->end_derived) {
+        flags |= PACKED_END;
+        const uint8_t end_len = strnlen((const char *) hist->end_buf, 7);
+        memcpy(buf + len, hist->end_buf, end_len);
+        len += end_len;
+        buf[len ++] = end_len;
+    }
+    uint8_t state;
+    memcpy(&state, &hist->state, 1);
+    buf[len ++] = flags | (state & 0x0F) << PACKED_STATE_SHIFT;
+
+    if (packed_top + len > HIST_PACKED_SIZE) {
+        uint16_t kept = 0;
+        uint8_t kept_num = 0;
+        while (kept_num < packed_num) {
+            const uint8_t size = packed_size(packed_top - kept);
+            if (kept + size > HIST_PACKED_SIZE - HIST_PACKED_FREE) {
+                break;
+            }
+            kept += size;
+            kept_num ++;
+        }
+        memmove(packed, packed + packed_top - kept, kept);
+        packed_top = kept;
+        packed_num = kept_num;
+    }
+    memcpy(packed + packed_top, buf, len);
+    packed_top += len;
+    packed_num ++;
+}
+
+static void hist_unpack(history_t *const hist) {
+    uint16_t top = packed_top;
+    const uint8_t flags = packed[-- top];
+    const uint8_t state = (flags >> PACKED_STATE_SHIFT) & 0x0F;
+    memcpy(&hist->state, &state, 1);
+    hist->end_derived = (flags & PACKED_END) != 0;
+    if (flags & PACKED_END) {
+        const uint8_t end_len = packed[-- top];
+        top -= end_len;
+        memset(hist->end_buf, 0, 7);
+        memcpy(hist->end_buf, packed + top, end_len);
+    } else if (flags & PACKED_RAW) {
+        hist->end_buf[0] = 0;
+    } else {
+        hist->end_buf[0] = HIST_END_UNKNOWN;
+    }
+    const uint8_t ortho_len = flags & PACKED_ORTHO_LEN ? packed[-- top] : 0;
+    uint32_t bucket = 0, stroke = 0;
+    if (flags & PACKED_INLINE) {
+        uint32_t payload = 0;
+        top -= BUCKET_INLINE_SIZE;
+        memcpy(&payload, packed + top, BUCKET_INLINE_SIZE);
+        bucket = 0xF00001 | (payload & 0xFFFF) << 4 | (payload >> 16) << 24;
+    } else if (!(flags & PACKED_RAW)) {
+        top -= 4;
+        memcpy(&bucket, packed + top, 4);
+    }
+    const uint8_t strokes_len = BUCKET_GET_STROKES_LEN(bucket);
+    if (flags & (PACKED_RAW | PACKED_INLINE)) {
+        top -= STROKE_SIZE;
+        memcpy(&stroke, packed + top, STROKE_SIZE);
+    } else if (strokes_len) {
+        store_read(BUCKET_GET_ADDR(bucket) + STROKE_SIZE * (strokes_len - 1), (uint8_t *) &stroke, STROKE_SIZE);
+    }
+    hist->bucket = bucket;
+    hist->stroke = stroke;
+    hist->ortho_len = flags & PACKED_ORTHO_LEN ? ortho_len : strokes_len ? strokes_len : 1;
+    hist->len = packed[-- top];
+    hist->prefix_lens = 0xFFFF;
+    hist->out_len = HIST_OUT_NONE;
+    packed_top = top;
+    packed_num --;
+}
+
+uint8_t hist_next(const uint8_t h_ind) {
+    const uint8_t next = HIST_LIMIT(h_ind + 1);
+    if (hist_depth == HIST_SIZE - 1) {
+        hist_pack(hist_get(next));
+    } else {
+        hist_depth ++;
+    }
+    return next;
+}
+
+uint8_t hist_prev(const uint8_t h_ind) {
+    const uint8_t prev = HIST_LIMIT(h_ind - 1);
+    if (hist_depth) {
+        hist_depth --;
+    }
+    // The entry right before the ones in the history is either the one packed last, or nothing, which stops the
+    // lookups and undo from going further back
+    history_t *const oldest = hist_get(HIST_LIMIT(prev - hist_depth - 1));
+    if (hist_depth == HIST_SIZE - 2 && packed_num) {
+        hist_unpack(oldest);
+        hist_depth ++;
+    } else {
+        oldest->len = 0;
+        oldest->stroke = 0;
+    }
+    return prev;
+}
+
+// The end of the word up to an entry, read from the entry again if it was packed away
+static const uint8_t *hist_end(history_t *const hist) {
+    if (hist->end_buf[0] == HIST_END_UNKNOWN) {
+        const uint32_t bucket = hist->bucket;
+        const uint8_t entry_len = BUCKET_GET_ENTRY_LEN(bucket);
+        const uint8_t start_of_end = entry_len < 7 ? 0 : entry_len - 7;
+        const uint8_t end_len = entry_len - start_of_end;
+        memset(hist->end_buf, 0, 7);
+        if (BUCKET_IS_INLINE(bucket)) {
+            for (uint8_t i = 0; i < end_len; i ++) {
+                hist->end_buf[i] = BUCKET_INLINE_BYTE(bucket, start_of_end + i);
+            }
+        } else {
+            store_read(BUCKET_GET_ENTRY_PTR(bucket) + start_of_end, hist->end_buf, end_len);
+        }
+        // As copied with `strncpy` from the entry
+        for (uint8_t i = strnlen((const char *) hist->end_buf, 7); i < 7; i ++) {
+            hist->end_buf[i] = 0;
+        }
+    }
+    return hist->end_buf;
+}
+
+
+// Sends the output of a history entry again from the record, if it's there
+static bool hist_out_replay(const history_t *const hist) {
+    const uint16_t start = hist->out_end - hist->out_len;
+    if (hist->out_len == HIST_OUT_NONE || (uint16_t) (hist_out_pos - start) > HIST_OUT_SIZE) {
+        return false;
+    }
+    for (uint16_t i = start; i != hist->out_end; i ++) {
+        const char c = hist_out[i & HIST_OUT_MASK];
+        if (c < 32) {
+            steno_back(c);
+        } else {
+            steno_send_char(c);
+        }
+    }
+    return true;
+}
+
+// Length of the word at the end of `typed`, as far back as it's kept
+static uint8_t steno_typed_word_len(void) {
+    if (back_pending > typed_len) {
+        return 0;
+    }
+    const uint8_t avail = typed_len - back_pending;
+    const uint8_t end = typed_end - back_pending;
+    uint8_t len = 0;
+    for (; len < avail; len ++) {
+        const char c = typed[(end - len - 1) & TYPED_MASK];
+        if (!isalpha(c) && c != '\'' && c != '-') {
+            break;
+        }
+    }
+    return len;
+}
+
+// Retroactive commands, on the output of the last history entries as still kept in `typed`: changes the case of the
+// last word or the space before the last entry, only erasing and typing again from the first character that changes.
+// Returns the length of the output, which takes the place of the entries' like an orthography rule, or 0 if their
+// output isn't known
+static uint8_t steno_retro(const uint8_t cmd, const uint8_t h_ind) {
+    history_t *const hist = hist_get(h_ind);
+#ifndef STENO_READONLY
+    if (editing_state != ED_IDLE) {
+        return 0;
+    }
+#endif
+    // The case is changed for the whole word, which a suffix stroke may only be the end of, so the entries back to
+    // where it starts are taken together
+    const uint8_t word_len = cmd <= 10 ? steno_typed_word_len() : 0;
+    uint8_t len = 0, strokes = 0;
+    do {
+        const history_t *const last_hist = hist_get(HIST_LIMIT(h_ind - 1 - strokes));
+        if (!last_hist->len || !last_hist->ortho_len || strokes + last_hist->ortho_len >= HIST_SIZE
+                || len + last_hist->len > TYPED_SIZE) {
+            return 0;
+        }
+        len += last_hist->len;
+        strokes += last_hist->ortho_len;
+    } while (len < word_len);
+    if (back_pending + len > typed_len) {
+        return 0;
+    }
+    char text[TYPED_SIZE + 1];
+    for (uint8_t i = 0; i < len; i ++) {
+        text[i] = typed[(typed_end - back_pending - len + i) & TYPED_MASK];
+    }
+
+    char *out = text;
+    uint8_t out_len = len;
+    const uint8_t word_start = word_len ? len - word_len : 0;
+    switch (cmd) {
+    case 8: // Lowercase last
+    case 9: // Uppercase last
+        for (uint8_t i = word_start; i < len; i ++) {
+            text[i] = cmd == 8 ? tolower(text[i]) : toupper(text[i]);
+        }
+        break;
+    case 10: // Capitalize last
+        for (uint8_t i = word_start; i < len; i ++) {
+            if (text[i] != ' ') {
+                text[i] = toupper(text[i]);
+                break;
+            }
+        }
+        break;
+    case 13: // Space before last
+        if (text[0] != ' ') {
+            memmove(text + 1, text, len);
+            text[0] = ' ';
+            out_len ++;
+        }
+        break;
+    case 14: // No space before last
+        if (text[0] == ' ' && len > 1) {
+            out ++;
+            out_len --;
+        }
+        break;
+    }
+    steno_back(len);
+    for (uint8_t i = 0; i < out_len; i ++) {
+        steno_send_char(out[i]);
+    }
+    hist->ortho_len = strokes + 1;
+    const uint8_t start_of_end = out_len < 7 ? 0 : out_len - 7;
+    memset(hist->end_buf, 0, 7);
+    memcpy(hist->end_buf, out + start_of_end, out_len - start_of_end);
+    hist->end_derived = 1;
+    return out_len;
+}
+
 // Undo the last history entry. First delete the output, and then start from the initial state of the
 // multi-stage input, and rebuild the output from there.
 void hist_undo(const uint8_t h_ind) {
@@ -219,6 +678,11 @@ void hist_undo(const uint8_t h_ind) {
     steno_debug_ln("  strokes: %u", strokes_len);
 #endif
     const uint8_t repl_len = strokes_len > 1 ? strokes_len - 1 : 0;
+    if (repl_len > hist_depth) {
+        hist->len = 0;
+        steno_error_ln("ortho past hist");
+        return;
+    }
     for (uint8_t i = 0; i < repl_len; i++) {
         const uint8_t old_hist_ind = HIST_LIMIT(h_ind + i - repl_len);
         const history_t *const old_hist = hist_get(old_hist_ind);
@@ -230,19 +694,62 @@ void hist_undo(const uint8_t h_ind) {
             steno_error_ln("bad prev hist entry");
             return;
         }
-        process_output(old_hist_ind);
+        if (!hist_out_replay(old_hist)) {
+            process_output(old_hist_ind);
+        }
     }
     return;
 }
 
+// The whole word that `word_end` is the end of, from `typed`, for the orthography to check its result against the
+// word list. Returns its length, or 0 if where it starts isn't known any more or `typed` doesn't end in `word_end`
+static uint8_t steno_typed_word(const char *const word_end, char *const word) {
+#ifndef STENO_READONLY
+    if (editing_state != ED_IDLE) {
+        return 0;
+    }
+#endif
+    const uint8_t len = steno_typed_word_len();
+    const uint8_t end = typed_end - back_pending;
+    // Something has to be before the word for it to be known where it starts
+    if (back_pending > typed_len || len == typed_len - back_pending) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < len; i ++) {
+        word[i] = typed[(end - len + i) & TYPED_MASK];
+    }
+    word[len] = 0;
+    const uint8_t end_len = strlen(word_end);
+    for (uint8_t i = 1; i <= end_len && i <= len; i ++) {
+        if (word[len - i] != word_end[end_len - i]) {
+            return 0;
+        }
+    }
+    return len;
+}
+
 // Process the output. If it's a raw stroke (no nodes found for the input), then just output the stroke;
 // otherwise, load the entry, perform the necessary transformations for capitalization, and output according
 // to the bytes. Also takes care of outputting key codes and Unicode characters.
+static state_t render_output(uint8_t h_ind);
 state_t process_output(const uint8_t h_ind) {
+    if (out_depth++ == 0) {
+        hist_out_start = hist_out_pos;
+        out_recording = true;
+    }
+    const state_t new_state = render_output(h_ind);
+    if (--out_depth == 0) {
+        history_t *const hist = hist_get(h_ind);
+        hist->out_end = hist_out_pos;
+        hist->out_len = out_recording ? hist_out_pos - hist_out_start : HIST_OUT_NONE;
+    }
+    return new_state;
+}
+
+static state_t render_output(const uint8_t h_ind) {
 #ifdef STENO_DEBUG_HIST
     steno_debug_ln("proc_out(%u)", h_ind);
 #endif
-    // TODO optimization: compare beginning of current and string to replace
     history_t *const hist = hist_get(h_ind);
     const state_t old_state = hist->state;
     state_t new_state = old_state;
@@ -261,6 +768,8 @@ state_t process_output(const uint8_t h_ind) {
             new_state.glue = 1;
         }
         hist->ortho_len = 1;
+        hist->end_buf[0] = 0;
+        hist->end_derived = 0;
 #ifdef STENO_DEBUG_HIST
         steno_debug("  out: '");
 #endif
@@ -277,16 +786,17 @@ state_t process_output(const uint8_t h_ind) {
         return new_state;
     }
 
+    // The entry is interpreted as it's read, a window at a time
     const uint32_t bucket = hist->bucket;
-    memset(kvpair_buf, 0, 128);      // TODO optimize
-    read_entry(bucket, kvpair_buf);
+    entry_cursor_t cur;
+    const uint8_t attr_byte = entry_open(&cur, bucket);
     const uint8_t entry_len = BUCKET_GET_ENTRY_LEN(bucket);
 #ifdef STENO_DEBUG_HIST
     steno_debug_ln("  entry_len: %u", entry_len);
 #endif
 
     const uint8_t strokes_len = BUCKET_GET_STROKES_LEN(hist->bucket);
-    const attr_t attr = *((attr_t *) &kvpair_buf[strokes_len * STROKE_SIZE]);
+    const attr_t attr = *((attr_t *) &attr_byte);
     new_state.space = attr.space_after;
     new_state.glue = attr.glue;
     uint8_t space = old_state.space && attr.space_prev && entry_len && !(old_state.glue && attr.glue);
@@ -294,17 +804,25 @@ state_t process_output(const uint8_t h_ind) {
     steno_debug_ln("  attr: prev, glue, after: %u%u%u", attr.space_prev, attr.glue, attr.space_after);
     steno_debug("  output: '");
 #endif
-    const uint8_t *entry = kvpair_buf + STROKE_SIZE * strokes_len + 1;
+    // Only there if the entry is short enough to be read in one go
+    const uint8_t *const entry = entry_whole(&cur);
 
-    // Possible suffix
-    if (!attr.space_prev && strokes_len == 1) {
-        const uint8_t last_hist_ind = HIST_LIMIT(h_ind - strokes_len);
-        const history_t *const last_hist = hist_get(last_hist_ind);
+    // Possible suffix, which has to fit in `output` along with the end of the word, and the strokes it changes in
+    // the history so that it can be undone
+    const uint8_t last_hist_ind = HIST_LIMIT(h_ind - strokes_len);
+    history_t *const last_hist = hist_get(last_hist_ind);
+    if (!attr.space_prev && strokes_len == 1 && entry && last_hist->ortho_len + strokes_len < HIST_SIZE) {
         char word_end[32];
-        memcpy(word_end, last_hist->end_buf, 8);
+        memcpy(word_end, hist_end(last_hist), 7);
+        word_end[7] = 0;
+        char suffix[ENTRY_WINDOW];
+        memcpy(suffix, entry, entry_len);
+        suffix[entry_len] = 0;
         char output[16] = {0};
+        char word[TYPED_SIZE + 1];
+        const bool word_known = steno_typed_word(word_end, word);
         // NOTE assuming everything is ascii i.e. no commands, unicode, keycodes
-        const int8_t ret = process_ortho((const char *) word_end, (const char *) entry, output);
+        const int8_t ret = process_ortho((const char *) word_end, word_known ? word : NULL, suffix, output);
         if (ret >= 0) {
             const uint8_t output_len = strlen(output);
             const uint8_t old_end_len = strlen((const char *) word_end);
@@ -313,7 +831,7 @@ state_t process_output(const uint8_t h_ind) {
             word_end[output_total_len] = 0;
             const uint8_t start_of_end = output_total_len < 7 ? 0 : output_total_len - 7;
             strncpy((char *) hist->end_buf, (const char *) word_end + start_of_end, 7);
-            hist->end_buf[7] = 0;
+            hist->end_derived = 1;
             if (ret > 0) {
                 hist->len = last_hist->len - ret + output_len;
                 hist->ortho_len = strokes_len + last_hist->ortho_len;
@@ -331,9 +849,16 @@ state_t process_output(const uint8_t h_ind) {
             return new_state;
         }
     }
-    const uint8_t start_of_end = entry_len < 7 ? 0 : entry_len - 7;
-    strncpy((char *) hist->end_buf, (const char *) entry + start_of_end, 7);
-    hist->end_buf[7] = 0;
+    if (entry) {
+        const uint8_t start_of_end = entry_len < 7 ? 0 : entry_len - 7;
+        memset(hist->end_buf, 0, 7);
+        for (uint8_t i = start_of_end; i < entry_len && entry[i]; i ++) {
+            hist->end_buf[i - start_of_end] = entry[i];
+        }
+    } else {
+        hist->end_buf[0] = HIST_END_UNKNOWN;
+    }
+    hist->end_derived = 0;
     hist->ortho_len = strokes_len;
 
     {
@@ -369,8 +894,6 @@ state_t process_output(const uint8_t h_ind) {
                     }
                     process_output(old_hist_ind);
                 }
-                // Reread the bucket cuz buffer is used
-                read_entry(bucket, kvpair_buf);
                 counter -= old_strokes_len;
             } else {
                 steno_error_ln("??? ortho %u strokes %u counter %u", old_ortho_len, old_strokes_len, counter);
@@ -378,20 +901,37 @@ state_t process_output(const uint8_t h_ind) {
         }
     }
 
+    if (attr.text) {
+        // Plain text, with nothing to look for in it; the case is back to normal after it, as with any entry that
+        // doesn't set it
+        if (space) {
+            steno_send_char(' ');
+        }
+        steno_send_text(&cur, entry_len, new_state.cap);
+        new_state.cap = CAPS_NORMAL;
+#ifdef STENO_DEBUG_HIST
+        steno_debug_ln("'");
+        steno_debug_ln("  -> %u", space + entry_len);
+#endif
+        hist->len = space + entry_len;
+        return new_state;
+    }
+
     uint8_t valid_len = 1, str_len = 0;
-    uint8_t set_case;
+    uint8_t set_case = 0;
     for (uint8_t i = 0; i < entry_len; i++) {
+        const uint8_t c = entry_next(&cur);
         // Commands
         set_case = 0;
-        if (entry[i] < 32) {
+        if (c < 32) {
 #ifdef STENO_DEBUG_HIST
             steno_debug("'\n    ");
 #endif
-            switch (entry[i]) {
+            switch (c) {
             case 0: // raw bytes of "length"
                 space = 0;
-                const uint8_t len = entry[i + 1];
-                const uint8_t keycode_len = steno_send_keycodes(entry + i + 2, len);
+                const uint8_t len = entry_next(&cur);
+                const uint8_t keycode_len = steno_send_keycodes(&cur, len);
                 if (keycode_len > 0) {
                     str_len += keycode_len;
                 } else {
@@ -425,7 +965,7 @@ state_t process_output(const uint8_t h_ind) {
                 break;
 
             case 4:; // keep case after "length" amount of characters
-                const uint8_t length = entry[++i];
+                const uint8_t length = entry_next(&cur);
 #ifdef STENO_DEBUG_HIST
                 steno_debug_ln("KEEP(%u)", length);
 #endif
@@ -436,21 +976,25 @@ state_t process_output(const uint8_t h_ind) {
                     steno_send_char(' ');
                     space = 0;
                 }
-                for ( ; i < end; i++) {
-                    if (entry[i] >= 32 && entry[i] <= 127) {
-                        steno_send_char(entry[i]);
+                while (i < end) {
+                    const uint8_t kept = entry_next(&cur);
+                    if (kept >= 32 && kept <= 127) {
+                        steno_send_char(kept);
                         str_len++;
-                    } else if (entry[i] >= 128) {
-                        int32_t code_point = 0;
-                        const char *str = decode_utf8((char *) &entry[i], &code_point);
+                    } else if (kept >= 128) {
 #ifndef STENO_NOUNICODE
+                        const int32_t code_point = entry_next_utf8(&cur, kept, &i);
                         if (code_point > 0) {
                             str_len += steno_send_unicode(code_point);
                         }
+#else
+                        entry_next_utf8(&cur, kept, &i);
 #endif
-                        i += str - (char *) &entry[i];
                     }
+                    i ++;
                 }
+                // Not counting the increment at the end of the loop
+                i --;
                 new_state.cap = old_state.cap;
                 set_case = 1;
                 break;
@@ -459,8 +1003,49 @@ state_t process_output(const uint8_t h_ind) {
                 new_state.cap = CAPS_NORMAL;
                 break;
 
+            case 6:; // text of "length"
+                const uint8_t run_len = entry_next(&cur);
+                if (space) {
+                    str_len++;
+                    steno_send_char(' ');
+                    space = 0;
+                }
+                new_state.cap = steno_send_text(&cur, run_len, new_state.cap);
+                str_len += run_len;
+                i += run_len + 1;
+                break;
+
+            case 8: // Retroactive commands
+            case 9:
+            case 10:
+            case 13:
+            case 14:;
+                space = 0;
+                // Only on their own, with nothing typed before them
+                const uint8_t retro_len = str_len ? 0 : steno_retro(c, h_ind);
+                if (!retro_len) {
+                    steno_error_ln("retro: no last output");
+                    valid_len = 0;
+                }
+                str_len += retro_len;
+                // Spacing and case carry on from the last entry
+                new_state = old_state;
+                set_case = 1;
+                break;
+
+            case 11: // Repeat last stroke, done by `ebd_steno_process_stroke`
+                repeat_stroke = true;
+                valid_len = 0;
+                break;
+
+            case 12: // Toggle asterisk on last stroke, done by `ebd_steno_process_stroke`
+                toggle_star = true;
+                valid_len = 0;
+                break;
+
 #ifndef STENO_READONLY
             case 16: // Dictionary editing
+                out_recording = false;
                 if (editing_state != ED_IDLE) {
                     dict_edit_puts("{dicted}");
                     str_len += 8;
@@ -471,51 +1056,31 @@ state_t process_output(const uint8_t h_ind) {
 #endif
 
             default:
-                steno_error_ln("\nInvalid cmd: %X", entry[i]);
+                steno_error_ln("\nInvalid cmd: %X", c);
                 return new_state;
             }
 #ifdef STENO_DEBUG_HIST
             steno_debug("    '");
 #endif
-        } else if (entry[i] < 127) {
+        } else if (c < 127) {
             if (space) {
                 str_len++;
                 steno_send_char(' ');
                 space = 0;
             }
-            switch (new_state.cap) {
-            case CAPS_NORMAL:
-                steno_send_char(entry[i]);
-                break;
-            case CAPS_LOWER:
-                steno_send_char(tolower(entry[i]));
-                if (entry[i] == ' ') {
-                    new_state.cap = CAPS_NORMAL;
-                }
-                break;
-            case CAPS_CAP:
-                steno_send_char(toupper(entry[i]));
-                new_state.cap = CAPS_NORMAL;
-                break;
-            case CAPS_UPPER:
-                steno_send_char(toupper(entry[i]));
-                if (entry[i] == ' ') {
-                    new_state.cap = CAPS_NORMAL;
-                }
-                break;
-            }
+            new_state.cap = steno_send_cased(c, new_state.cap);
             str_len++;
             // Unicode
         } else {
-            int32_t code_point = 0;
-            const char *str = decode_utf8((char *) &entry[i], &code_point);
 #ifndef STENO_NOUNICODE
+            const int32_t code_point = entry_next_utf8(&cur, c, &i);
             if (code_point > 0) {
                 steno_send_unicode(code_point);
             }
+#else
+            entry_next_utf8(&cur, c, &i);
 #endif
             str_len += 1;
-            i = str - (char *) entry;
         }
     }
     if (!set_case) {
@@ -2,9 +2,13 @@
 
 #include "stroke.h"
 
-#define HIST_SIZE 32
-#define HIST_MASK 0x1F
+// Entries kept as they are, for the lookups and the undo of the last strokes; the ones before are packed away (see
+// `hist_next`), and brought back as the strokes after them are undone
+#define HIST_SIZE 16
+#define HIST_MASK 0x0F
 #define HIST_LIMIT(a) ((a) & HIST_MASK)
+// In the first byte of `end_buf` when it has to be read from the entry again
+#define HIST_END_UNKNOWN 0xFF
 
 typedef struct __attribute__((packed)) {
     uint8_t space : 1;
@@ -15,13 +19,33 @@ typedef struct __attribute__((packed)) {
 typedef struct __attribute__((packed)) {
     uint8_t len;
     state_t state;
-    uint8_t ortho_len;       // Length of orthographic entries' total strokes
+    uint8_t ortho_len : 7;   // Length of orthographic entries' total strokes
+    // Whether `end_buf` isn't just the end of the entry, i.e. it's after an orthography rule or a retro command
+    uint8_t end_derived : 1;
     uint32_t stroke : 24;
     // Pointer + strokes length of the bucket; invalid if 0 or -1
     uint32_t bucket;
-    uint8_t end_buf[8];
+    // Bit `n - 1` is set if the last `n` strokes up to this one are a proper prefix of some entry
+    uint16_t prefix_lens;
+    // End of the word up to this entry, for orthography; nul terminated if shorter
+    uint8_t end_buf[7];
+    // Where the output of this entry ends in the record of the output, and its length there; `HIST_OUT_NONE` if
+    // it's not recorded
+    uint16_t out_end;
+    uint8_t out_len;
 } history_t;
 
+// Set by `process_output` when the entry asks for the last stroke to be replaced by itself with the asterisk toggled
+extern bool toggle_star;
+// Set by `process_output` when the entry asks for the last stroke to be stroked again
+extern bool repeat_stroke;
+
+// Moves on from `h_ind` once it's in the history, to the next entry to fill in
+uint8_t hist_next(uint8_t h_ind);
+// Moves back from `h_ind` to the last entry in the history, to be undone
+uint8_t hist_prev(uint8_t h_ind);
 void hist_undo(uint8_t h_ind);
+// Sends the backspaces held back by the output so far, to be called once the stroke is processed
+void steno_flush_back(void);
 history_t *hist_get(uint8_t ind);
 state_t process_output(uint8_t h_ind);
@@ -0,0 +1,2 @@
+#pragma once
+// Nothing from QMK's common config is needed on the host
@@ -0,0 +1,4 @@
+// The firmware's SPI flash driver as is, talking to the flash model in `spi.c`
+#include "host.h"
+#include "spi.h"
+#include "../qmk/flash.c"
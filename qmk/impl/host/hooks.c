@@ -0,0 +1,145 @@
+// HID and timer stand-ins; whatever the engine types is applied to an in-memory text buffer
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "quantum.h"
+#include "process_keycode/process_unicode_common.h"
+#include "host.h"
+#include "hid_out.h"
+
+hid_stats_t hid_stats;
+
+static char *text = NULL;
+static size_t text_len = 0, text_cap = 0;
+
+static void text_push(const char c) {
+    if (text_len + 1 >= text_cap) {
+        text_cap = text_cap ? text_cap * 2 : 4096;
+        text = realloc(text, text_cap);
+    }
+    text[text_len++] = c;
+    text[text_len] = 0;
+}
+
+const char *hid_text(void) {
+    return text ? text : "";
+}
+
+const uint8_t ascii_to_keycode_lut[128] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // 00 01 02 03 04 05 06 07
+    0x2A, 0x2B, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00,   // BS TAB LF 0B 0C 0D 0E 0F
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // 10 11 12 13 14 15 16 17
+    0x00, 0x00, 0x00, 0x29, 0x00, 0x00, 0x00, 0x00,   // 18 19 1A ESC 1C 1D 1E 1F
+    0x2C, 0x1E, 0x34, 0x20, 0x21, 0x22, 0x24, 0x34,   // SPC ! " # $ % & '
+    0x26, 0x27, 0x25, 0x2E, 0x36, 0x2D, 0x37, 0x38,   // ( ) * + , - . /
+    0x27, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24,   // 0 1 2 3 4 5 6 7
+    0x25, 0x26, 0x33, 0x33, 0x36, 0x2E, 0x37, 0x38,   // 8 9 : ; < = > ?
+    0x1F, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,   // @ A B C D E F G
+    0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12,   // H I J K L M N O
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A,   // P Q R S T U V W
+    0x1B, 0x1C, 0x1D, 0x2F, 0x31, 0x30, 0x23, 0x2D,   // X Y Z [ \ ] ^ _
+    0x35, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,   // ` a b c d e f g
+    0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12,   // h i j k l m n o
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A,   // p q r s t u v w
+    0x1B, 0x1C, 0x1D, 0x2F, 0x31, 0x30, 0x35, 0x4C,   // x y z { | } ~ DEL
+};
+const uint8_t ascii_to_shift_lut[16] = {
+    0x00, 0x00, 0x00, 0x00, 0x7E, 0x0F, 0x00, 0xD4,
+    0xFF, 0xFF, 0xFF, 0xC7, 0x00, 0x00, 0x00, 0x78
+};
+const uint8_t ascii_to_altgr_lut[16] = {0};
+
+// The keys down as of the last report sent, and the report being built
+static uint8_t report_keys[6], report_len = 0, report_mods = 0;
+static uint8_t sent_keys[6], sent_len = 0;
+
+void add_key(const uint8_t key) {
+    if (report_len < 6) {
+        report_keys[report_len++] = key;
+    }
+}
+
+void clear_keys(void) {
+    report_len = 0;
+}
+
+void add_weak_mods(const uint8_t mods) {
+    report_mods |= mods;
+}
+
+void clear_weak_mods(void) {
+    report_mods = 0;
+}
+
+// Types what a key newly down in a report would on a US layout host, going through the keys in report order
+static void key_press(const uint8_t key, const uint8_t mods) {
+    if (key == KC_BSPC && !mods) {
+        hid_stats.backspaces ++;
+        if (text_len > 0) {
+            text[--text_len] = 0;
+        }
+        return;
+    }
+    const bool shift = mods == MOD_BIT(KC_LSFT);
+    if (!mods || shift) {
+        for (uint8_t c = ' '; c < 0x7F; c ++) {
+            if (ascii_to_keycode_lut[c] == key && PGM_LOADBIT(ascii_to_shift_lut, c) == shift) {
+                hid_stats.chars ++;
+                text_push(c);
+                return;
+            }
+        }
+    }
+    hid_stats.keys ++;
+}
+
+void send_keyboard_report(void) {
+    hid_stats.reports ++;
+    for (uint8_t i = 0; i < report_len; i ++) {
+        if (!memchr(sent_keys, report_keys[i], sent_len)) {
+            key_press(report_keys[i], report_mods);
+        }
+    }
+    memcpy(sent_keys, report_keys, report_len);
+    sent_len = report_len;
+}
+
+bool hid_out_ready(void) {
+    return true;
+}
+
+void register_unicode(const uint32_t code_point) {
+    hid_stats.unicode ++;
+    text_push('?');
+}
+
+const char *decode_utf8(const char *str, int32_t *const code_point) {
+    const uint8_t *const s = (const uint8_t *) str;
+    if (s[0] < 0x80) {
+        *code_point = s[0];
+        return str + 1;
+    } else if ((s[0] & 0xE0) == 0xC0) {
+        *code_point = ((int32_t) (s[0] & 0x1F) << 6) | (s[1] & 0x3F);
+        return str + 2;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        *code_point = ((int32_t) (s[0] & 0x0F) << 12) | ((int32_t) (s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+        return str + 3;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        *code_point = ((int32_t) (s[0] & 0x07) << 18) | ((int32_t) (s[1] & 0x3F) << 12)
+            | ((int32_t) (s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+        return str + 4;
+    }
+    *code_point = -1;
+    return str + 1;
+}
+
+uint16_t timer_read(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint16_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+uint16_t timer_elapsed(const uint16_t last) {
+    return timer_read() - last;
+}
@@ -0,0 +1,66 @@
+#pragma once
+// Interfaces only available on the host build, used by the replay driver to inspect the engine
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IMAGE_SIZE 0x1000000
+
+typedef struct {
+    uint32_t reads;
+    uint32_t read_bytes;
+    uint32_t writes;
+    uint32_t write_bytes;
+    uint32_t erases;
+} store_stats_t;
+
+typedef struct {
+    uint32_t reports;
+    // Keys typed, as told apart by the host from the reports
+    uint32_t chars;
+    uint32_t backspaces;
+    uint32_t keys;
+    uint32_t unicode;
+} hid_stats_t;
+
+typedef struct {
+    // Chip selects, i.e. commands
+    uint32_t selects;
+    uint32_t cmd_bytes;
+    uint32_t addr_bytes;
+    // Data in or out after the address, including status polling
+    uint32_t data_bytes;
+    // Commands ignored because the flash was busy programming or erasing
+    uint32_t busy_ignored;
+    // Simulated time on the bus, including waiting for the flash
+    uint64_t ns;
+} spi_stats_t;
+
+// Costs used to turn bus traffic into time. The defaults are for the ATmega32u4 at 16MHz running SPI at
+// F_CPU/2, and the typical timings of the W25Q128JV
+typedef struct {
+    uint32_t cpu_hz;
+    uint32_t spi_hz;
+    // CPU overhead of each byte on top of the 8 SPI clocks (function call, polling SPIF)
+    uint8_t byte_cycles;
+    // CPU overhead of asserting and releasing CS
+    uint8_t select_cycles;
+    uint32_t program_first_byte_ns;
+    uint32_t program_next_byte_ns;
+    uint32_t program_page_ns;
+    uint32_t erase_4k_ns;
+    uint64_t erase_chip_ns;
+} spi_timing_t;
+
+// The whole 16MB storage, as laid out by the dictionary compiler
+extern uint8_t *image;
+extern store_stats_t store_stats;
+extern hid_stats_t hid_stats;
+extern spi_stats_t spi_stats;
+extern spi_timing_t spi_timing;
+
+// Load either a UF2 file as produced by the compiler, or a raw 16MB image. Writes are never
+// persisted back to the file
+bool image_load(const char *const path);
+// Text typed so far, after applying backspaces
+const char *hid_text(void);
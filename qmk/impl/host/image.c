@@ -0,0 +1,79 @@
+// Loading compiled dictionaries into a flash sized memory image
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "host.h"
+
+#define UF2_MAGIC0 0x0A324655
+#define UF2_MAGIC1 0x9E5D5157
+#define UF2_MAGIC_END 0x0AB16F30
+#define UF2_BLOCK_SIZE 512
+#define UF2_HEADER_SIZE 32
+#define UF2_DATA_SIZE 256
+
+uint8_t *image;
+store_stats_t store_stats;
+
+static uint32_t u32_at(const uint8_t *const p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static bool load_uf2(const uint8_t *const file, const size_t size) {
+    image = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (image == MAP_FAILED) {
+        return false;
+    }
+    memset(image, 0xFF, IMAGE_SIZE);
+    for (size_t off = 0; off + UF2_BLOCK_SIZE <= size; off += UF2_BLOCK_SIZE) {
+        const uint8_t *const block = file + off;
+        const uint32_t addr = u32_at(block + 12);
+        if (u32_at(block) != UF2_MAGIC0 || u32_at(block + 4) != UF2_MAGIC1
+                || u32_at(block + UF2_BLOCK_SIZE - 4) != UF2_MAGIC_END || u32_at(block + 16) != UF2_DATA_SIZE
+                || addr + UF2_DATA_SIZE > IMAGE_SIZE) {
+            fprintf(stderr, "bad UF2 block at 0x%zX\n", off);
+            return false;
+        }
+        memcpy(image + addr, block + UF2_HEADER_SIZE, UF2_DATA_SIZE);
+    }
+    return true;
+}
+
+bool image_load(const char *const path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 4) {
+        close(fd);
+        return false;
+    }
+    const size_t size = st.st_size;
+    uint8_t *const file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    bool ok;
+    if (u32_at(file) == UF2_MAGIC0) {
+        ok = load_uf2(file, size);
+        munmap(file, size);
+    } else if (size == IMAGE_SIZE) {
+        munmap(file, size);
+        // Private mapping, so the engine can write without touching the file
+        image = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ok = image != MAP_FAILED;
+    } else {
+        fprintf(stderr, "%s: neither UF2 nor a 16MB raw image\n", path);
+        munmap(file, size);
+        ok = false;
+    }
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+void register_unicode(uint32_t code_point);
+const char *decode_utf8(const char *str, int32_t *code_point);
@@ -0,0 +1,33 @@
+#pragma once
+// Minimal stand-in for QMK's `quantum.h`, just enough for the engine to be built on a PC
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define SAFE_RANGE 0x5F00
+#define KC_BSPC 0x2A
+#define KC_LSFT 0xE1
+#define KC_RALT 0xE6
+#define MOD_BIT(code) (1 << ((code) & 0x07))
+
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define PGM_LOADBIT(mem, pos) ((pgm_read_byte(&((mem)[(pos) / 8])) >> ((pos) % 8)) & 0x01)
+
+#define xprintf(...) fprintf(stderr, __VA_ARGS__)
+
+// US layout, as in QMK's `send_string.c`
+extern const uint8_t ascii_to_keycode_lut[128];
+extern const uint8_t ascii_to_shift_lut[16];
+extern const uint8_t ascii_to_altgr_lut[16];
+
+// Keyboard report
+void add_key(uint8_t key);
+void clear_keys(void);
+void add_weak_mods(uint8_t mods);
+void clear_weak_mods(void);
+void send_keyboard_report(void);
+
+uint16_t timer_read(void);
+uint16_t timer_elapsed(uint16_t last);
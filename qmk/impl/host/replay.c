@@ -0,0 +1,200 @@
+// Replays a stroke log through the engine against a dictionary image, reporting the storage traffic
+// and simulated SPI bus time of every stroke and of each `print_time` phase inside it
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "steno.h"
+#include "store.h"
+#include "stroke.h"
+#include "host.h"
+#include "hid_out.h"
+
+#define MAX_PHASES 8
+#define LINE_SIZE 1024
+
+typedef struct {
+    const char *name;
+    store_stats_t store;
+    spi_stats_t spi;
+    struct timespec time;
+} mark_t;
+
+static mark_t marks[MAX_PHASES];
+static uint8_t mark_num = 0;
+
+static void mark(mark_t *const m, const char *const name) {
+    m->name = name;
+    m->store = store_stats;
+    m->spi = spi_stats;
+    clock_gettime(CLOCK_MONOTONIC, &m->time);
+}
+
+void steno_profile_phase(const char *const phase) {
+    if (mark_num < MAX_PHASES) {
+        mark(&marks[mark_num++], phase);
+    }
+}
+
+static double elapsed_us(const mark_t *const from, const mark_t *const to) {
+    return (to->time.tv_sec - from->time.tv_sec) * 1e6 + (to->time.tv_nsec - from->time.tv_nsec) / 1e3;
+}
+
+static double bus_us(const mark_t *const from, const mark_t *const to) {
+    return (to->spi.ns - from->spi.ns) / 1e3;
+}
+
+// Same notation as Plover and the compiler, e.g. `KAT`, `-G`, `#S` or `12`
+static bool parse_stroke(const char *const str, uint32_t *const stroke) {
+    const char *const KEYS = "#STKPWHRAO*EUFRPBLGTSDZ";
+    const char *const DIGITS = "12345067890";
+    const uint8_t DIGIT_BITS[] = {21, 20, 18, 16, 14, 13, 9, 7, 5, 3};
+    uint8_t ind = 0;
+    *stroke = 0;
+    for (const char *c = str; *c; c ++) {
+        if (*c >= '0' && *c <= '9') {
+            *stroke |= (uint32_t) 1 << 22;
+            *stroke |= (uint32_t) 1 << DIGIT_BITS[strchr(DIGITS, *c) - DIGITS];
+        } else if (*c == '-') {
+            ind = 10;
+        } else if (*c == '#') {
+            *stroke |= (uint32_t) 1 << 22;
+        } else {
+            const char *const key = strchr(KEYS + ind, *c);
+            if (!key) {
+                return false;
+            }
+            ind = key - KEYS;
+            *stroke |= (uint32_t) 1 << (22 - ind);
+        }
+    }
+    return *stroke != 0;
+}
+
+static void usage(const char *const prog) {
+    fprintf(stderr, "usage: %s [-q] [-t] [-s spi_hz] <dict.uf2 | image.bin> [strokes.txt]\n", prog);
+    fprintf(stderr, "  -q  only print the summary\n");
+    fprintf(stderr, "  -t  print the resulting text\n");
+    fprintf(stderr, "  -s  SPI clock used for bus time (default F_CPU/2 = %u)\n", spi_timing.spi_hz);
+    fprintf(stderr, "Strokes are separated by whitespace or '/', and read from stdin if no file is given\n");
+}
+
+int main(int argc, char **argv) {
+    bool quiet = false, print_text = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "qts:h")) != -1) {
+        switch (opt) {
+        case 'q': quiet = true; break;
+        case 't': print_text = true; break;
+        case 's': spi_timing.spi_hz = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!image_load(argv[optind])) {
+        return 1;
+    }
+    FILE *const log = optind + 1 < argc ? fopen(argv[optind + 1], "r") : stdin;
+    if (!log) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+
+    ebd_steno_init();
+
+    uint32_t stroke_num = 0, max_reads = 0, max_reads_ind = 0;
+    double total_us = 0, max_us = 0, max_bus_us = 0;
+    mark_t first;
+    mark(&first, "first");
+    store_stats_t total = {0};
+    char line[LINE_SIZE];
+    if (!quiet) {
+        printf("#\tstroke\treads\tbytes\twrites\tcs\tbus_us\tphases (reads/bytes/bus_us)\n");
+    }
+    while (fgets(line, LINE_SIZE, log)) {
+        for (char *tok = strtok(line, " \t\r\n/"); tok; tok = strtok(NULL, " \t\r\n/")) {
+            uint32_t stroke;
+            if (!parse_stroke(tok, &stroke)) {
+                fprintf(stderr, "skipping invalid stroke '%s'\n", tok);
+                continue;
+            }
+            mark_t start, end;
+            mark_num = 0;
+            mark(&start, "start");
+            ebd_steno_process_stroke(stroke);
+            mark(&end, "end");
+            // What the main loop does in between strokes, sending whatever isn't held back
+            while (hid_out_task()) {
+            }
+
+            const uint32_t reads = end.store.reads - start.store.reads;
+            const uint32_t read_bytes = end.store.read_bytes - start.store.read_bytes;
+            const uint32_t writes = end.store.writes - start.store.writes;
+            const double us = elapsed_us(&start, &end);
+            const double stroke_bus_us = bus_us(&start, &end);
+            total.reads += reads;
+            total.read_bytes += read_bytes;
+            total.writes += writes;
+            total_us += us;
+            if (reads > max_reads) {
+                max_reads = reads;
+                max_reads_ind = stroke_num;
+            }
+            if (us > max_us) {
+                max_us = us;
+            }
+            if (stroke_bus_us > max_bus_us) {
+                max_bus_us = stroke_bus_us;
+            }
+            if (!quiet) {
+                printf("%u\t%s\t%u\t%u\t%u\t%u\t%.1f\t", stroke_num, tok, reads, read_bytes, writes,
+                       end.spi.selects - start.spi.selects, stroke_bus_us);
+                const mark_t *prev = &start;
+                for (uint8_t i = 0; i < mark_num; i ++) {
+                    printf(" %s:%u/%u/%.1f", marks[i].name, marks[i].store.reads - prev->store.reads,
+                           marks[i].store.read_bytes - prev->store.read_bytes, bus_us(prev, &marks[i]));
+                    prev = &marks[i];
+                }
+                printf("\n");
+            }
+            stroke_num ++;
+        }
+    }
+
+    hid_out_flush();
+    if (stroke_num > 0) {
+        printf("strokes: %u\n", stroke_num);
+        printf("reads: %u total, %.2f/stroke, max %u (stroke %u)\n", total.reads, (double) total.reads / stroke_num,
+               max_reads, max_reads_ind);
+        printf("bytes read: %u total, %.2f/stroke\n", total.read_bytes, (double) total.read_bytes / stroke_num);
+        printf("writes: %u\n", total.writes);
+        mark_t last;
+        mark(&last, "last");
+        const double total_bus_us = bus_us(&first, &last);
+        printf("spi: %u selects, %u cmd + %u addr + %u data bytes, %u ignored while busy\n",
+               last.spi.selects - first.spi.selects, last.spi.cmd_bytes - first.spi.cmd_bytes,
+               last.spi.addr_bytes - first.spi.addr_bytes, last.spi.data_bytes - first.spi.data_bytes,
+               last.spi.busy_ignored - first.spi.busy_ignored);
+        printf("bus time @ %.1fMHz: %.1fus total, %.2fus/stroke, max %.1fus\n", spi_timing.spi_hz / 1e6, total_bus_us,
+               total_bus_us / stroke_num, max_bus_us);
+#if STORE_CACHE_LINES
+        printf("cache: %u hits, %u misses\n", store_cache_stats.hits, store_cache_stats.misses);
+#endif
+        // Each skipped candidate is at least one bucket read, against the one read of the filter block
+        printf("suffix filter: %u reads, %u searches skipped, %.2f reads saved/stroke\n", suffix_filter_stats.reads,
+               suffix_filter_stats.skipped,
+               ((double) suffix_filter_stats.skipped - suffix_filter_stats.reads) / stroke_num);
+        printf("host time: %.1fus total, %.2fus/stroke, max %.1fus\n", total_us, total_us / stroke_num, max_us);
+        printf("hid: %u reports, %u chars, %u backspaces, %u keys, %u unicode\n", hid_stats.reports, hid_stats.chars,
+               hid_stats.backspaces, hid_stats.keys, hid_stats.unicode);
+    }
+    if (print_text) {
+        printf("%s\n", hid_text());
+    }
+    return 0;
+}
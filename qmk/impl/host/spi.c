@@ -0,0 +1,176 @@
+// Model of the W25Q128 SPI NOR flash over the in-memory image. Every byte and chip select is tallied
+// and turned into bus time, and programs and erases keep the flash busy for as long as the real part
+#include <string.h>
+#include "host.h"
+#include "spi.h"
+
+#define OP_PROGRAM 0x02
+#define OP_READ 0x03
+#define OP_WRITE_DISABLE 0x04
+#define OP_READ_STATUS 0x05
+#define OP_WRITE_ENABLE 0x06
+#define OP_ERASE_4K 0x20
+#define OP_ERASE_CHIP 0xC7
+
+#define STATUS_BUSY 0x01
+#define STATUS_WEL 0x02
+
+#define PAGE_SIZE 256
+#define SECTOR_SIZE 0x1000
+
+spi_stats_t spi_stats;
+spi_timing_t spi_timing = {
+    .cpu_hz = 16000000,
+    .spi_hz = 16000000 / 2,
+    .byte_cycles = 8,
+    .select_cycles = 4,
+    .program_first_byte_ns = 30000,
+    .program_next_byte_ns = 2500,
+    .program_page_ns = 400000,
+    .erase_4k_ns = 45000000,
+    .erase_chip_ns = 40000000000ull,
+};
+
+static bool selected = false;
+static bool has_opcode;
+static uint8_t opcode;
+static uint8_t addr_left;
+static uint32_t addr;
+// Data bytes in the current command
+static uint16_t data_len;
+static bool write_enabled = false;
+static uint64_t busy_until = 0;
+
+static bool busy(void) {
+    return spi_stats.ns < busy_until;
+}
+
+static uint8_t addr_len(const uint8_t op) {
+    switch (op) {
+    case OP_PROGRAM:
+    case OP_READ:
+    case OP_ERASE_4K:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+static uint8_t transfer(const uint8_t out) {
+    spi_stats.ns += 8ull * 1000000000 / spi_timing.spi_hz + (uint64_t) spi_timing.byte_cycles * 1000000000 / spi_timing.cpu_hz;
+    if (!selected) {
+        return 0xFF;
+    }
+    if (!has_opcode) {
+        has_opcode = true;
+        opcode = out;
+        addr_left = addr_len(opcode);
+        addr = 0;
+        spi_stats.cmd_bytes ++;
+        if (busy() && opcode != OP_READ_STATUS) {
+            spi_stats.busy_ignored ++;
+            opcode = 0;
+        }
+        return 0xFF;
+    }
+    if (addr_left) {
+        addr = (addr << 8) | out;
+        addr_left --;
+        spi_stats.addr_bytes ++;
+        return 0xFF;
+    }
+    spi_stats.data_bytes ++;
+    switch (opcode) {
+    case OP_READ: {
+        const uint8_t in = image[(addr + data_len) & (IMAGE_SIZE - 1)];
+        data_len ++;
+        return in;
+    }
+    case OP_READ_STATUS:
+        return (busy() ? STATUS_BUSY : 0) | (write_enabled ? STATUS_WEL : 0);
+    case OP_PROGRAM:
+        if (write_enabled) {
+            // Wraps around within the page, like the real part
+            image[(addr & ~(uint32_t) (PAGE_SIZE - 1)) | ((addr + data_len) & (PAGE_SIZE - 1))] &= out;
+        }
+        data_len ++;
+        return 0xFF;
+    default:
+        return 0xFF;
+    }
+}
+
+void select_card(void) {
+    selected = true;
+    has_opcode = false;
+    data_len = 0;
+    spi_stats.selects ++;
+    spi_stats.ns += (uint64_t) spi_timing.select_cycles * 1000000000 / spi_timing.cpu_hz;
+}
+
+// Commands take effect when CS is released
+void unselect_card(void) {
+    if (!selected || !has_opcode) {
+        selected = false;
+        return;
+    }
+    selected = false;
+    switch (opcode) {
+    case OP_READ:
+        store_stats.reads ++;
+        store_stats.read_bytes += data_len;
+        break;
+    case OP_WRITE_ENABLE:
+        write_enabled = true;
+        break;
+    case OP_WRITE_DISABLE:
+        write_enabled = false;
+        break;
+    case OP_PROGRAM:
+        if (write_enabled && data_len > 0) {
+            const uint64_t t = spi_timing.program_first_byte_ns + (uint64_t) (data_len - 1) * spi_timing.program_next_byte_ns;
+            busy_until = spi_stats.ns + (t < spi_timing.program_page_ns ? t : spi_timing.program_page_ns);
+            store_stats.writes ++;
+            store_stats.write_bytes += data_len;
+        }
+        write_enabled = false;
+        break;
+    case OP_ERASE_4K:
+        if (write_enabled) {
+            memset(image + (addr & (IMAGE_SIZE - SECTOR_SIZE)), 0xFF, SECTOR_SIZE);
+            busy_until = spi_stats.ns + spi_timing.erase_4k_ns;
+            store_stats.erases ++;
+        }
+        write_enabled = false;
+        break;
+    case OP_ERASE_CHIP:
+        if (write_enabled) {
+            memset(image, 0xFF, IMAGE_SIZE);
+            busy_until = spi_stats.ns + spi_timing.erase_chip_ns;
+            store_stats.erases ++;
+        }
+        write_enabled = false;
+        break;
+    }
+}
+
+void spi_init(void) {}
+
+void spi_send_byte(const uint8_t b) {
+    transfer(b);
+}
+
+void spi_send_word(const uint16_t w) {
+    spi_send_byte(w >> 8);
+    spi_send_byte(w);
+}
+
+void spi_send_addr(const uint32_t addr) {
+    spi_send_byte((addr >> 16) & 0xFF);
+    spi_send_byte((addr >> 8) & 0xFF);
+    spi_send_byte(addr & 0xFF);
+}
+
+uint8_t spi_recv_byte(void) {
+    return transfer(0xFF);
+}
@@ -0,0 +1,17 @@
+#ifndef _SPI_H_
+#define _SPI_H_
+// Host counterpart of `impl/qmk/spi.h`; shares the include guard so that `impl/qmk/flash.c` picks this
+// one up instead. The other end of the bus is the flash model in `spi.c`
+
+#include <stdint.h>
+
+void select_card(void);
+void unselect_card(void);
+
+void spi_init(void);
+void spi_send_byte(uint8_t);
+void spi_send_word(uint16_t);
+void spi_send_addr(uint32_t);
+uint8_t spi_recv_byte(void);
+
+#endif
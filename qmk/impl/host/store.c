@@ -0,0 +1,69 @@
+// Storage backed by the in-memory image, counting every access
+#include <string.h>
+#include "host.h"
+#include "store.h"
+
+// Matches the UF2 payload size, see `scsi_write`
+#define REWRITE_SIZE 256
+
+void store_init(void) {}
+
+void store_read_uncached(const uint32_t offset, uint8_t *const buf, const uint8_t len) {
+    store_stats.reads ++;
+    store_stats.read_bytes += len;
+    for (uint8_t i = 0; i < len; i ++) {
+        // Unmapped addresses read as erased
+        buf[i] = offset + i < IMAGE_SIZE ? image[offset + i] : 0xFF;
+    }
+}
+
+static uint32_t cursor;
+
+void store_read_begin(const uint32_t offset) {
+    store_stats.reads ++;
+    cursor = offset;
+}
+
+void store_read_next(uint8_t *const buf, const uint8_t len) {
+    store_stats.read_bytes += len;
+    for (uint8_t i = 0; i < len; i ++, cursor ++) {
+        buf[i] = cursor < IMAGE_SIZE ? image[cursor] : 0xFF;
+    }
+}
+
+void store_read_end(void) {}
+
+void store_flush(void) {}
+
+void store_write_direct(const uint32_t offset, const uint8_t *const buf, const uint8_t len) {
+    store_cache_invalidate(offset, len);
+    store_stats.writes ++;
+    store_stats.write_bytes += len;
+    for (uint8_t i = 0; i < len && offset + i < IMAGE_SIZE; i ++) {
+        // NOR flash can only clear bits without an erase
+        image[offset + i] &= buf[i];
+    }
+}
+
+void store_erase_partial(const uint32_t offset, const uint8_t len) {
+    store_cache_invalidate(offset, len);
+    store_stats.erases ++;
+    if (offset + len <= IMAGE_SIZE) {
+        memset(image + offset, 0xFF, len);
+    }
+}
+
+void store_rewrite_start(void) {
+    store_cache_invalidate(0, IMAGE_SIZE);
+    store_stats.erases ++;
+    memset(image, 0xFF, IMAGE_SIZE);
+}
+
+void store_rewrite_write(const uint32_t offset, const uint8_t *const buf) {
+    store_cache_invalidate(offset, REWRITE_SIZE);
+    store_stats.writes ++;
+    store_stats.write_bytes += REWRITE_SIZE;
+    if (offset + REWRITE_SIZE <= IMAGE_SIZE) {
+        memcpy(image + offset, buf, REWRITE_SIZE);
+    }
+}
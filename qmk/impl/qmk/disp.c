@@ -77,14 +77,14 @@ void disp_tape_show_raw_stroke(const uint32_t stroke) {
 
 void disp_tape_show_strokes(const uint8_t *strokes, const uint8_t len) {
     disp_clear();
-    const uint32_t first_stroke = *((uint32_t *) kvpair_buf);
+    const uint32_t first_stroke = *((uint32_t *) strokes);
     select_lcd();
     lcd_pos(0, 0);
     unselect_lcd();
     disp_tape_show_stroke(first_stroke);
     for (uint8_t i = 1; i < len; i ++) {
         disp_putc('/');
-        const uint32_t stroke = *((uint32_t *) (kvpair_buf + STROKE_SIZE * i));
+        const uint32_t stroke = *((uint32_t *) (strokes + STROKE_SIZE * i));
         disp_tape_show_stroke(stroke);
 #ifdef STENO_STROKE_DISPLAY
         if (i == len - 1) {
@@ -16,7 +16,7 @@ void store_init(void) {
     spi_init();
 }
 
-void store_read(const uint32_t offset, uint8_t *const buf, const uint8_t len) {
+void store_read_uncached(const uint32_t offset, uint8_t *const buf, const uint8_t len) {
 #ifdef STENO_DEBUG_FLASH
     if (flash_debug_enable) {
         steno_debug_ln("flash_read(# 0x%02X @ 0x%06lX)", len, offset);
@@ -31,6 +31,28 @@ void store_read(const uint32_t offset, uint8_t *const buf, const uint8_t len) {
     unselect_card();
 }
 
+// Keeps CS asserted between the pieces, as the read command carries on to the following addresses
+void store_read_begin(const uint32_t offset) {
+#ifdef STENO_DEBUG_FLASH
+    if (flash_debug_enable) {
+        steno_debug_ln("flash_read_begin(@ 0x%06lX)", offset);
+    }
+#endif
+    select_card();
+    spi_send_byte(0x03);    // read 
+    spi_send_addr(offset);
+}
+
+void store_read_next(uint8_t *const buf, const uint8_t len) {
+    for (uint8_t i = 0; i < len; i ++) {
+        buf[i] = spi_recv_byte();
+    }
+}
+
+void store_read_end(void) {
+    unselect_card();
+}
+
 // Read a program page into buffer
 static void flash_read_page(uint32_t addr, uint8_t *buf) {
 #ifdef STENO_DEBUG_FLASH
@@ -88,6 +110,7 @@ static void flash_write(const uint32_t addr, const uint8_t *const buf, const uin
 }
 
 void store_write_direct(const uint32_t offset, const uint8_t *const buf, const uint8_t len) {
+    store_cache_invalidate(offset, len);
     flash_write(offset, buf, len);
 }
 
@@ -126,6 +149,7 @@ void flash_erase_4k(const uint32_t addr) {
 }
 
 void store_erase_partial(const uint32_t offset, const uint8_t len) {
+    store_cache_invalidate(offset, len);
     uint8_t page_buffer[FLASH_PP_SIZE];
     const uint32_t block_addr = offset & 0xFFF000; // Alighed to 4k, smallest Erase Unit
     flash_erase_4k(SCRATCH_START);
@@ -156,6 +180,7 @@ void store_erase_partial(const uint32_t offset, const uint8_t len) {
 }
 
 void store_rewrite_start(void) {
+    store_cache_invalidate(0, STORE_END);
     flash_prep_write();
     select_card();
     // Device erase
@@ -164,5 +189,6 @@ void store_rewrite_start(void) {
 }
 
 void store_rewrite_write(const uint32_t offset, const uint8_t *const buf) {
+    store_cache_invalidate(offset, FLASH_PP_SIZE);
     flash_write_page(offset, buf);
 }
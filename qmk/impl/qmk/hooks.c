@@ -1,4 +1,7 @@
 #include "steno.h"
+#include "hid_out.h"
+#include <LUFA/Drivers/USB/USB.h>
+#include "usb_descriptor.h"
 
 void keyboard_post_init_user(void) {
     ebd_steno_init();
@@ -8,6 +11,10 @@ static bool steno_key_valid(const uint16_t key) {
     return key >= STN__Z && key <= STN_NUM;
 }
 
+void matrix_scan_user(void) {
+    hid_out_task();
+}
+
 bool process_record_user(uint16_t keycode, keyrecord_t *record) {
     static uint32_t pressed = 0;
     static uint32_t current = 0;
@@ -29,3 +36,15 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
     }
 }
 
+
+// The keyboard endpoint's bank is free once the host has polled the last report out of it
+bool hid_out_ready(void) {
+    if (USB_DeviceState != DEVICE_STATE_Configured) {
+        return true;
+    }
+    const uint8_t ep = Endpoint_GetCurrentEndpoint();
+    Endpoint_SelectEndpoint(KEYBOARD_IN_EPNUM);
+    const bool ready = Endpoint_IsINReady();
+    Endpoint_SelectEndpoint(ep);
+    return ready;
+}
@@ -4,179 +4,90 @@
 #include <string.h>
 #include <ctype.h>
 
-static bool strneq(const char *const a, const char *const b, const uint8_t n) {
-    return strncmp(a, b, n) == 0;
-}
-
-static bool chrin(const char *const s, const char c) {
-    return c != 0 && strchr(s, c);
-}
-
-// Returns how many chars to backspace, and what text (`output`) to append after
-// NOTE assumes the suffix we get is valid, so no end of string checking
+// The regex rules, compiled by the compiler into a DFA over the start of the suffix, which ends in the DFA over the
+// end of the word (backwards) for the rules whose suffixes matched, which in turn ends in the first rule that matches.
 // Rules borrowed from https://github.com/nimble0/dotterel/blob/master/app/src/main/assets/orthography/english.regex.json
-static int8_t regex_ortho(const char *const word, const char *const suffix, char *const output) {
-    const uint8_t word_len = strlen(word);
-    char rev[WORD_ENDING_SIZE];
-    // Invert `word` so that indexing is anchored to the end
-    for (uint8_t i = 0; i < WORD_ENDING_SIZE; i ++) {
-        if (word_len >= i) {
-            rev[i] = word[word_len - i - 1];
-        }
-    }
+#define REGEX_START (ORTHOGRAPHY_START + 0x10000)
+// What each rule does: the backspaces, how much of the suffix to leave off, and the text to put in between, where
+// bytes below `REGEX_CAPTURE_END` are the character that many from the end of the word
+#define REGEX_ACTION_SIZE 8
+#define REGEX_CAPTURE_END 8
+// The transitions of the states that aren't final, a byte for each symbol, starting with the suffix DFA. Final states
+// have `REGEX_FINAL` set along with the row of the word DFA or the rule
+#define REGEX_ROWS_START (REGEX_START + 0x100)
+#define REGEX_SYMBOLS 29
+#define REGEX_FINAL 0x80
+#define REGEX_NO_RULE 0xFF
+
+// The end of the string, `a` to `z`, any other letter, and anything else
+static uint8_t regex_symbol(const char c) {
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 1;
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return 27;
+    }
+    return c ? 28 : 0;
+}
 
-    // { ([aeiou]c)$ or (ion)$ or (.*ur)e } + ly -> \1ally
-    if (strneq(suffix, "ly", 2)) {
-        if ((rev[0] == 'c' && chrin("aeiou", rev[1])) || strneq(rev, "noi", 3)) {
-            strcat(output, "ally");
-            strcat(output, suffix + 2);
-            return 0;
-        }
-        if (strneq(rev, "eru", 3)) {
-            strcat(output, "ally");
-            strcat(output, suffix + 2);
-            return 1;
-        }
-    }
-    
-    // (t)e + (ry|ries) -> \1o\2
-    if (strneq("et", rev, 2) && (strneq("ry", suffix, 2) || strneq("ries", suffix, 4))) {
-        output[0] = 'o';
-        strcat(output, suffix);
-        return 1;
-    }
+// The first row of the suffix DFA, which every suffix goes through, and which is as far as most of them go; read on
+// its first use after `ortho_init`, so that it's never from a dictionary that has since been rewritten
+static uint8_t regex_suffix_start[REGEX_SYMBOLS];
+static bool regex_suffix_start_read = false;
 
-    // ([naeiou])te? + (cy|cies) -> \1\2
-    if (strneq("cy", suffix, 2) || strneq("cies", suffix, 4)) {
-        const uint8_t t_start = rev[0] == 'e';
-        if (rev[t_start] == 't' && chrin("naeiou", rev[t_start + 1])) {
-            strcat(output, suffix);
-            return t_start + 1;
-        }
-    }
+void ortho_init(void) {
+    regex_suffix_start_read = false;
+}
 
-    // word: (s|sh|x|z|zh)
-    //       ((?:oa|ea|i|ee|oo|au|ou|l|n|(?<![gin]a)r|t)ch)
-    //  + s([^\w]|$) -> \1es\2
-    // ([bcdfghjklmnpqrstvwxz])y + s([^\w]|$) -> \1ies\2
-    // End of string is just \0, which is not [[:alpha:]]
-    if (suffix[0] == 's' && !isalpha(suffix[1])) {
-        if ((chrin("sxz", rev[0]) || (rev[0] == 'h' && (rev[1] == 's' || rev[1] == 'z')))
-                || (strneq("hc", rev, 2) && (chrin("ilnt", rev[2]) || strneq("ao", rev + 2, 2) || strneq("ae", rev + 2, 2)
-                        || strneq("ee", rev + 2, 2) || strneq("oo", rev + 2, 2)
-                        || strneq("ua", rev + 2, 2) || strneq("uo", rev + 2, 2)
-                        || (rev[2] == 'r' && !(rev[3] == 'a' && chrin("gin", rev[4])))))) {
-            output[0] = 'e';
-            strcat(output, suffix);
-            return 0;
-        }
-        if (rev[0] == 'y' && chrin("bcdfghjklmnpqrstvwxz", rev[1])) {
-            output[0] = 'i'; output[1] = 'e';
-            strcat(output, suffix);
-            return 1;
+static uint8_t regex_step(const uint8_t state, const char c) {
+    if (state == 0) {
+        if (!regex_suffix_start_read) {
+            store_read_uncached(REGEX_ROWS_START, regex_suffix_start, REGEX_SYMBOLS);
+            regex_suffix_start_read = true;
         }
+        return regex_suffix_start[regex_symbol(c)];
     }
+    uint8_t next;
+    store_read_uncached(REGEX_ROWS_START + (uint16_t) state * REGEX_SYMBOLS + regex_symbol(c), &next, 1);
+    return next;
+}
 
-    // (\w)ie + ing -> \1ying
-    if (strneq("ei", rev, 2) && isalpha(rev[2]) && strneq("ing", suffix, 3)) {
-        strcpy(output, "ying");
-        return 2;
-    }
-
-    // (\w[cdfghlmnpr])y + ist -> \1ist
-    if (strneq("ist", suffix, 3) && rev[0] == 'y' && chrin("cdfghlmnpr", rev[1])) {
-        output[0] = rev[1];
-        strcat(output, "ist");
-        return 1;
-    }
-
-    // (\w[bcdfghjklmnpqrstvwxz])y + ([abcdefghjklnopqrstuxz]) -> \1i\2
-    if (rev[0] == 'y' && chrin("bcdfghjklmnpqrstvwxz", rev[1]) && isalpha(rev[2]) && chrin("abcdefghjklnopqrstuxz", suffix[0])) {
-        strcat(output, "i");
-        strcat(output, suffix);
-        return 1;
-    }
-
-    // word: (\w[^aeiou]it)
-    //       (\wct)
-    //       (\w[^aeiou]is)e
-    //       (\w[aeiou][bcdfghjklmnprstvwxyz]+at)e
-    //  + er(s?) -> \1or\2
-    if (strneq("er", suffix, 2)) {
-        if (rev[0] == 't' && (rev[1] == 'c' || (rev[1] == 'i' && !chrin("aeiou", rev[2])))) {
-            output[0] = 'o';
-            strcat(output, suffix + 1);
-            return 0;
-        }
-        if (rev[0] == 'e') {
-            if (rev[1] == 's' && rev[2] == 'i' && !chrin("aeiou", rev[3])) {
-                output[0] = 'o';
-                strcat(output, suffix + 1);
-                return 1;
-            }
-            if (rev[1] == 't' && rev[2] == 'a' && chrin("bcdfghjklmnprstvwxyz", rev[3])) {
-                uint8_t i = 4;
-                for ( ; i < WORD_ENDING_SIZE && chrin("bcdfghjklmnprstvwxyz", rev[i]); i ++);
-                if (chrin("aeiou", rev[i])) {
-                    output[0] = 'o';
-                    strcat(output, suffix + 1);
-                    return 1;
-                }
-            }
-        }
+// Returns how many chars to backspace, and what text (`output`) to append after
+static int8_t regex_ortho(const char *const word, const char *const suffix, char *const output) {
+    // Both DFAs are final after the end of the string
+    uint8_t state = 0;
+    for (const char *c = suffix; !(state & REGEX_FINAL); c ++) {
+        state = regex_step(state, *c);
     }
-
-    // (\w[bcdfghjklmnpqrstuvwxz])e + { ([aeiouy]\w) or ([aeoy]) } -> \1\2
-    if (rev[0] == 'e' && chrin("bcdfghjklmnpqrstuvwxz", rev[1]) && isalpha(rev[2]) \
-            && ((chrin("aeiouy", suffix[0]) && isalpha(suffix[1])) || chrin("aeoy", suffix[0]))) {
-        strcat(output, suffix);
-        return 1;
+    if (state == REGEX_NO_RULE) {
+        return -1;
     }
-
-    // ([aeiouy](?:pod|log)) + ([aeiouy]) -> \1\2
-    if (chrin("aeiouy", rev[3]) && (strneq("gol", rev, 3) || strneq("dop", rev, 3)) && chrin("aeiouy", suffix[0])) {
-        strcat(output, suffix);
-        return 0;
+    const uint8_t word_len = strlen(word);
+    state &= ~REGEX_FINAL;
+    for (uint8_t i = word_len; !(state & REGEX_FINAL); i --) {
+        state = regex_step(state, i ? word[i - 1] : 0);
     }
-
-    // ((?:[bcdfghjklmnprstvwxyz]|qu)[ae]l) + y -> \1ly
-    if (suffix[0] == 'y' && rev[0] == 'l' && (rev[1] == 'a' || rev[1] == 'e')
-            && (strneq("uq", rev + 2, 2) || chrin("bcdfghjklmnprstvwxyz", rev[2]))) {
-        output[0] = 'l'; output[1] = 'y';
-        return 0;
+    if (state == REGEX_NO_RULE) {
+        return -1;
     }
 
-    // suffix: (ed|en|er|ier|est|in[g]|y|ie|ies|iest|iness|ish|abl[ey]|ability|abilities)
-    // word: ((?:[bcdfghjklmnprstvwxyz]+|[bcdfghjklmnprstvwxyz]*qu)[aeiou])([bdfgklmnprstz])
-    //       ((?:[bcdfghjklmnprstvwxyz]|qu)a)([gbmptv])
-    //       ((?:[bcdfghjklmnprstvwxyz]|qu)e)([gbpv])
-    //       ((?:[bcdfghjklmnprstvwxyz]|qu)i)([gbmpv])
-    //       ((?:[bcdfghjklmnprstvwxyz]|qu)o)([gbdlv])
-    //       ([bcdfghjklmnprstvwxyz]u)([gbdlmntv])
-    // repl: \1\2\2\3
-    if ((suffix[0] == 'e' && (chrin("dnr", suffix[1]) || strneq(suffix + 1, "st", 2))) \
-            || (strneq(suffix, "ab", 2) && (suffix[2] == 'l' && chrin("ey", suffix[3]))) \
-                || (strneq(suffix + 2, "ilit", 4) && (suffix[6] == 'y' || strneq(suffix + 6, "ies", 3))) \
-            || (suffix[0] == 'i' && chrin("ne", suffix[1]))      // Omitting `ier`, `ies`, `iest`
-            || strneq(suffix, "ish", 3)
-            || suffix[0] == 'y') {
-        if ((rev[1] == 'a' && chrin("gbmptv", rev[0])) || (rev[1] == 'e' && chrin("gbpv", rev[0]))
-                || (rev[1] == 'i' && chrin("gbmpv", rev[0])) || (rev[1] == 'o' && chrin("gbdlv", rev[0]))
-                || (rev[1] == 'u' && chrin("gbdlmntv", rev[0]))
-                || (chrin("bdfgklmnprstz", rev[0]) && chrin("aeiou", rev[1]))) {
-            const bool junk = chrin("bcdfghjklmnprstvwxyz", rev[2]);
-            if (junk || (rev[1] != 'u' && strneq("uq", rev + 2, 2))) {
-                output[0] = rev[0];
-                strcat(output, suffix);
-                return 0;
-            }
-        }
+    uint8_t action[REGEX_ACTION_SIZE];
+    store_read_uncached(REGEX_START + (uint16_t) (state & ~REGEX_FINAL) * REGEX_ACTION_SIZE, action, REGEX_ACTION_SIZE);
+    uint8_t len = 0;
+    for (uint8_t i = 2; i < REGEX_ACTION_SIZE && action[i]; i ++) {
+        output[len ++] = action[i] < REGEX_CAPTURE_END ? word[word_len - action[i]] : action[i];
     }
-    return -1;
+    strcpy(output + len, suffix + action[1]);
+    return action[0];
 }
 
-#define ORTHO_BUCKET_SIZE 3
-#define ORTHO_BUCKET_NUM 0x3C00
+// Buckets of the simple rules: the offset and length of the rule in a 3 byte word, followed by a byte of the upper 6
+// bits of the hash and the inverted displacement from the home bucket in 2 bits. They're laid out Robin Hood style,
+// with no wrapping around the end
+#define ORTHO_BUCKET_SIZE 4
+#define ORTHO_BUCKET_NUM 0x2000
+#define ORTHO_MAX_DISPLACEMENT 3
+#define ORTHO_FINGERPRINT_SHIFT 26
 #define BUCKET_OFFSET_BITS 18
 #define BUCKET_LENGTH_BITS 6
 
@@ -202,34 +113,121 @@ static int8_t simple_ortho(const char *const word, const char *const suffix, cha
     memcpy(merged + word_len + 1, suffix, suffix_len);
     const uint8_t merged_len = word_len + suffix_len + 1;
     const uint32_t hash = hash_str((const char *) merged);
-    const uint32_t bucket_ind = hash % (ORTHO_BUCKET_NUM - 1);
-    uint32_t bucket_addr = ORTHOGRAPHY_START + bucket_ind * ORTHO_BUCKET_SIZE;
-    uint32_t bucket;
+    const uint8_t fingerprint = hash >> ORTHO_FINGERPRINT_SHIFT;
+    uint32_t bucket_addr = ORTHOGRAPHY_START + (hash & (ORTHO_BUCKET_NUM - 1)) * ORTHO_BUCKET_SIZE;
 
     const uint8_t length_mask = (1 << BUCKET_LENGTH_BITS) - 1;
-    for (; ; bucket_addr += ORTHO_BUCKET_SIZE) {
-        store_read(bucket_addr, (uint8_t *) &bucket, ORTHO_BUCKET_SIZE);
+    // Buckets are read in one go until the rule's, or until one that's displaced less than the rule would be, and
+    // only a rule with the same fingerprint is read
+    store_read_begin(bucket_addr);
+    for (uint8_t i = 0; ; i ++, bucket_addr += ORTHO_BUCKET_SIZE) {
+        uint8_t buf[ORTHO_BUCKET_SIZE];
+        store_read_next(buf, ORTHO_BUCKET_SIZE);
+        const uint32_t bucket = U24_FROM_PTR_LE(buf);
         const uint8_t entry_len = (bucket >> BUCKET_OFFSET_BITS) & length_mask;
-        if (entry_len == length_mask) {
+        if (entry_len == length_mask || (3 ^ (buf[3] & 3)) < i) {
+            store_read_end();
             return -1;
         }
-        const uint32_t entry_addr = (bucket & (((uint32_t) 1 << BUCKET_OFFSET_BITS) - 1)) + (uint32_t) ORTHOGRAPHY_START + (uint32_t) ORTHO_BUCKET_SIZE * ORTHO_BUCKET_NUM;
-        uint8_t entry_buf[32];
+        // The entry is the merged string and its terminator, the return value and the output
+        if (buf[3] >> 2 != fingerprint || entry_len < merged_len + 2) {
+            continue;
+        }
+        store_read_end();
+        const uint32_t entry_addr = (bucket & (((uint32_t) 1 << BUCKET_OFFSET_BITS) - 1)) + (uint32_t) ORTHOGRAPHY_START
+            + (uint32_t) ORTHO_BUCKET_SIZE * (ORTHO_BUCKET_NUM + ORTHO_MAX_DISPLACEMENT);
+        uint8_t entry_buf[1 << BUCKET_LENGTH_BITS];
         store_read(entry_addr, entry_buf, entry_len);
         if (strcmp((const char *) merged, (const char *) entry_buf) == 0) {
             const uint8_t extra_len = entry_len - merged_len - 2;
             memcpy(output, entry_buf + merged_len + 2, extra_len);
             output[extra_len] = 0;
             return (int8_t) entry_buf[merged_len + 1];
-        } else {
-            continue;
         }
+        store_read_begin(bucket_addr + ORTHO_BUCKET_SIZE);
     }
     return -1;
 }
 
-int8_t process_ortho(const char *const word, const char *const suffix, char *const output) {
-    const int8_t ret = regex_ortho(word, suffix, output);
+// The word list, compiled by the compiler into a minimal acyclic automaton of the words in lowercase. Each node is a
+// header, the labels of its edges, then the 3 byte offsets of their children, but for the first with
+// `WORDS_FALLTHROUGH`, whose child is right after the node. A header of 0xFF is no word list at all
+#define WORDS_FINAL 0x80
+#define WORDS_FALLTHROUGH 0x40
+// Skipping up to this many bytes of a read costs less than addressing a new one
+#define WORDS_SKIP_MAX 4
+
+static uint32_t words_pos;
+
+static void words_read(uint8_t *const buf, const uint8_t len) {
+    store_read_next(buf, len);
+    words_pos += len;
+}
+
+static void words_seek(const uint32_t addr) {
+    if (addr >= words_pos && addr - words_pos <= WORDS_SKIP_MAX) {
+        uint8_t skipped[WORDS_SKIP_MAX];
+        words_read(skipped, addr - words_pos);
+        return;
+    }
+    store_read_end();
+    store_read_begin(addr);
+    words_pos = addr;
+}
+
+// Whether the first `prefix_len` chars of `prefix` followed by `rest` are in the word list. The walk down the
+// automaton is a single read for as long as it falls through to the next node
+static bool ortho_is_word(const char *const prefix, const uint8_t prefix_len, const char *const rest) {
+    words_pos = WORDS_START;
+    store_read_begin(WORDS_START);
+    uint8_t header;
+    words_read(&header, 1);
+    bool found = false;
+    for (uint8_t i = 0; header != 0xFF; i ++) {
+        const uint8_t c = tolower((uint8_t) (i < prefix_len ? prefix[i] : rest[i - prefix_len]));
+        if (!c) {
+            found = header & WORDS_FINAL;
+            break;
+        }
+        const uint32_t labels = words_pos;
+        const uint8_t len = header & ~(WORDS_FINAL | WORDS_FALLTHROUGH);
+        const uint8_t fallthrough = (header & WORDS_FALLTHROUGH) ? 1 : 0;
+        uint8_t edge = 0;
+        for (; edge < len; edge ++) {
+            uint8_t label;
+            words_read(&label, 1);
+            if (label == c) {
+                break;
+            }
+        }
+        if (edge == len) {
+            break;
+        }
+        if (fallthrough && edge == 0) {
+            words_seek(labels + len + 3 * (len - 1));
+        } else {
+            words_seek(labels + len + 3 * (edge - fallthrough));
+            uint8_t addr[3];
+            words_read(addr, 3);
+            words_seek(WORDS_START + U24_FROM_PTR_LE(addr));
+        }
+        words_read(&header, 1);
+    }
+    store_read_end();
+    return found;
+}
+
+int8_t process_ortho(const char *const word, const char *const whole, const char *const suffix, char *const output) {
+    int8_t ret = regex_ortho(word, suffix, output);
+    // A result that isn't a word, where the word and the suffix joined as they are is one, came from the wrong rule
+    if (ret >= 0 && whole) {
+        const uint8_t whole_len = strlen(whole);
+        if ((uint8_t) ret <= whole_len && !ortho_is_word(whole, whole_len - ret, output)
+                && ortho_is_word(whole, whole_len, suffix)) {
+            output[0] = 0;
+            ret = -1;
+        }
+    }
     if (ret == -1) {
         return simple_ortho(word, suffix, output);
     }
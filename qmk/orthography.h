@@ -1,5 +1,7 @@
 #pragma once
 
-#define WORD_ENDING_SIZE 8
-
-int8_t process_ortho(const char *word, const char *suffix, char *output);
+// Has what the orthography keeps in RAM read from the storage again, after the storage is set up or rewritten
+void ortho_init(void);
+// `whole` is the whole word that `word` is the end of, if it's known, to check the regex rules' result against the
+// word list
+int8_t process_ortho(const char *word, const char *whole, const char *suffix, char *output);
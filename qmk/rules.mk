@@ -1,8 +1,15 @@
 THIS_DIR := $(shell dirname $(realpath $(lastword $(MAKEFILE_LIST))))
 include $(THIS_DIR)/config.mk
 
-SRC += hist.c stroke.c orthography.c
+SRC += hist.c stroke.c orthography.c hid_out.c
 SRC += impl/qmk/hooks.c impl/qmk/spi.c impl/qmk/flash.c
+ifneq ($(STENO_STORE_CACHE),0)
+	SRC += store_cache.c
+	CFLAGS += -DSTORE_CACHE_LINES=$(STENO_STORE_CACHE)
+endif
+ifneq ($(STENO_LOOKAHEAD),0)
+	CFLAGS += -DSTENO_LOOKAHEAD=$(STENO_LOOKAHEAD)
+endif
 ifeq ($(STENO_NOUI),yes)
 	STENO_READONLY = yes
 	CFLAGS += -DSTENO_NOUI
@@ -39,6 +39,7 @@
 #include "store.h"
 #include "stroke.h"
 #include "dict_editing.h"
+#include "orthography.h"
 
 static bool scsi_inquiry(USB_ClassInfo_MS_Device_t *const MSInterfaceInfo);
 static bool scsi_request_sense(USB_ClassInfo_MS_Device_t *const MSInterfaceInfo);
@@ -164,9 +165,14 @@ void scsi_write(USB_ClassInfo_MS_Device_t *const msc_interface_info, const uint3
             if (header[5] == 0) {
                 steno_error_ln("erase");
                 store_rewrite_start();
+                ortho_init();
                 steno_error_ln("flash");
             }
             store_rewrite_write(header[3], data_buf);
+            if (header[5] == header[6] - 1) {
+                // Anything read from the dictionary while it was being written is from both the old and the new one
+                ortho_init();
+            }
         }
         if (msc_interface_info->State.IsMassStoreReset) {
             steno_error_ln("reset");
@@ -179,10 +185,7 @@ void scsi_write(USB_ClassInfo_MS_Device_t *const msc_interface_info, const uint3
     }
 }
 
-void scsi_read(USB_ClassInfo_MS_Device_t *const msc_interface_info, const uint32_t block_addr, uint16_t blocks) {
-    if (Endpoint_WaitUntilReady()) {
-        return;
-    }
+static void scsi_read_blocks(USB_ClassInfo_MS_Device_t *const msc_interface_info, const uint32_t block_addr, uint16_t blocks) {
     for (uint16_t i = 0; i < blocks; i ++) {
         for (uint8_t packet_num = 0; packet_num < 8; packet_num ++) {
             if (!(Endpoint_IsReadWriteAllowed())) {
@@ -203,6 +206,14 @@ void scsi_read(USB_ClassInfo_MS_Device_t *const msc_interface_info, const uint32
     }
 }
 
+void scsi_read(USB_ClassInfo_MS_Device_t *const msc_interface_info, const uint32_t block_addr, uint16_t blocks) {
+    if (Endpoint_WaitUntilReady()) {
+        return;
+    }
+    scsi_read_blocks(msc_interface_info, block_addr, blocks);
+    fat_read_done();
+}
+
 /** Command processing for an issued SCSI INQUIRY command. This command returns information about the device's features
  *  and capabilities to the host.
  */
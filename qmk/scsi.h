@@ -117,6 +117,8 @@ typedef struct {
 /* Function Prototypes: */
 bool handle_scsi_command(USB_ClassInfo_MS_Device_t *const MSInterfaceInfo);
 void fat_read_block(uint32_t block_no, uint8_t packet_num, uint8_t *data);
+// Ends the read that `fat_read_block` keeps going for the following packets
+void fat_read_done(void);
 void fat_write_block(uint32_t block_no, uint8_t packet_num, uint8_t *data);
 
 #define UF2_MAGIC0 0x0A324655
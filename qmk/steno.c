@@ -3,6 +3,8 @@
 #include "steno.h"
 #include "store.h"
 #include "hist.h"
+#include "hid_out.h"
+#include "orthography.h"
 #ifndef STENO_READONLY
 #include "dict_editing.h"
 #endif
@@ -22,16 +24,34 @@ uint8_t hist_ind = 0;
 // equal to `hist_ind` or 0xFF
 uint8_t stroke_start_ind = 0;
 uint16_t time = 0;
+#if STENO_LOOKAHEAD
+// Whether the strokes up to the last one are a prefix of some longer entry, so that the next stroke may replace its
+// output
+static bool lookahead = false;
+#endif
 
+#ifdef STENO_PROFILE
+#define print_time(sec) steno_profile_phase(sec);
+#else
 #define print_time(sec) steno_debug_ln("<> " sec ": %ums", timer_elapsed(time));
+#endif
 
 // Intercept the steno key codes, searches for the stroke, and outputs the output
 void _ebd_steno_process_stroke(const uint32_t stroke);
 void ebd_steno_process_stroke(const uint32_t stroke) {
 #ifdef CONSOLE_ENABLE
     time = timer_read();
+#endif
+#if STENO_LOOKAHEAD
+    lookahead = false;
 #endif
     _ebd_steno_process_stroke(stroke);
+    steno_flush_back();
+#if STENO_LOOKAHEAD
+    // Hold the output back until the next stroke shows whether it stays, if it comes soon enough. Either way, the
+    // history is the same as without holding, and only the backspaces over the output held end up not being sent
+    hid_out_hold(lookahead ? STENO_LOOKAHEAD : 0);
+#endif
 #ifdef STENO_FLASH_LOGGING
     flog_finish_cycle();
 #endif
@@ -53,7 +73,7 @@ void _ebd_steno_process_stroke(const uint32_t stroke) {
     print_time("dicted");
 
     if (stroke == STENO_STAR) {
-        hist_ind = HIST_LIMIT(hist_ind - 1);
+        hist_ind = hist_prev(hist_ind);
         hist_undo(hist_ind);
         print_time("undo");
 #ifndef STENO_NOUI
@@ -85,6 +105,22 @@ void _ebd_steno_process_stroke(const uint32_t stroke) {
 #endif
     const state_t new_state = process_output(hist_ind);
     print_time("out");
+    if (toggle_star || repeat_stroke) {
+        // Stroke the last stroke again in place of this one, or undo it and stroke it with the asterisk toggled
+        const bool toggle = toggle_star;
+        toggle_star = repeat_stroke = false;
+        const uint8_t last_ind = HIST_LIMIT(hist_ind - 1);
+        if (hist_get(last_ind)->len) {
+            uint32_t last_stroke = hist_get(last_ind)->stroke;
+            if (toggle) {
+                hist_ind = hist_prev(hist_ind);
+                hist_undo(hist_ind);
+                last_stroke ^= STENO_STAR;
+            }
+            _ebd_steno_process_stroke(last_stroke);
+        }
+        return;
+    }
 #ifdef STENO_DEBUG_HIST
     steno_debug_ln("next %u: scg: %u%u%u", HIST_LIMIT(hist_ind + 1), new_state.space, new_state.cap, new_state.glue);
 #endif
@@ -94,7 +130,12 @@ void _ebd_steno_process_stroke(const uint32_t stroke) {
 #endif
     {
         if (strokes_len > 0) {
-            disp_tape_show_strokes(kvpair_buf, strokes_len);
+            // Inline entries don't keep the stroke, and the other ones may not be the last looked up
+            if (!BUCKET_IS_INLINE(bucket)) {
+                store_read(BUCKET_GET_ADDR(bucket), kvpair_buf, STROKE_SIZE * strokes_len);
+            }
+            const uint32_t stroke = hist->stroke;
+            disp_tape_show_strokes(BUCKET_IS_INLINE(bucket) ? (const uint8_t *) &stroke : kvpair_buf, strokes_len);
             last_trans[last_trans_size] = 0;
             disp_tape_show_trans(last_trans);
         } else {
@@ -115,12 +156,15 @@ void _ebd_steno_process_stroke(const uint32_t stroke) {
             steno_debug_ln("  bucket: %08lX", hist->bucket);
         }
 #endif
-        hist_ind = HIST_LIMIT(hist_ind + 1);
+        hist_ind = hist_next(hist_ind);
         stroke_start_ind = 0xFF;
     } else {
         stroke_start_ind = hist_ind;
     }
     hist_get(hist_ind)->state = new_state;
+#if STENO_LOOKAHEAD
+    lookahead = hist->prefix_lens != 0;
+#endif
 
 #ifdef CONSOLE_ENABLE
     print_time("final");
@@ -134,6 +178,7 @@ void _ebd_steno_process_stroke(const uint32_t stroke) {
 void ebd_steno_init(void) {     // to avoid clashing with `steno_init` in QMK
     hist_get(0)->state.cap = CAPS_CAP;
     store_init();
+    ortho_init();
 #ifndef STENO_NOUI
     disp_init();
 #endif
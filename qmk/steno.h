@@ -31,6 +31,10 @@ extern uint8_t stroke_start_ind;
 
 void ebd_steno_init(void);
 void ebd_steno_process_stroke(const uint32_t stroke);
+#ifdef STENO_PROFILE
+// Called at each of the `print_time` points when processing a stroke
+void steno_profile_phase(const char *const phase);
+#endif
 
 enum {
     STN__Z = SAFE_RANGE,
@@ -1,8 +1,35 @@
 #pragma once
 
+#include <stdint.h>
+
 // Init the underlying storage
 void store_init(void);
-void store_read(uint32_t const offset, uint8_t *const buf, const uint8_t len);
+// Reads straight from the underlying storage
+void store_read_uncached(const uint32_t offset, uint8_t *const buf, const uint8_t len);
+#if STORE_CACHE_LINES
+// Reads through a cache in RAM of `STORE_CACHE_LINES` earlier reads of up to `STORE_CACHE_LINE_SIZE` bytes each
+#ifndef STORE_CACHE_LINE_SIZE
+#define STORE_CACHE_LINE_SIZE 32
+#endif
+void store_read(const uint32_t offset, uint8_t *const buf, const uint8_t len);
+// Drops the cached reads overlapping with the storage being changed
+void store_cache_invalidate(const uint32_t offset, const uint32_t len);
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+} store_cache_stats_t;
+extern store_cache_stats_t store_cache_stats;
+#else
+static inline void store_read(const uint32_t offset, uint8_t *const buf, const uint8_t len) {
+    store_read_uncached(offset, buf, len);
+}
+static inline void store_cache_invalidate(const uint32_t offset, const uint32_t len) {}
+#endif
+// Reading contiguous data piece by piece, without addressing each piece again: `store_read_next` pulls the next `len`
+// bytes after `offset`. No other storage access can happen until `store_read_end`
+void store_read_begin(const uint32_t offset);
+void store_read_next(uint8_t *const buf, const uint8_t len);
+void store_read_end(void);
 // Flush the erases and writes in the underlying storage; may be used for optimizations
 void store_flush(void);
 // Perform a raw/direct write to the underlying storage; this is when we know we are only clearing
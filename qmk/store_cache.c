@@ -0,0 +1,55 @@
+// Read cache in RAM in front of the storage, for the bytes that are read again shortly after, e.g. the entry found by
+// `find_strokes` that's read again for the output, or the history re-processed on undo. Each line keeps an earlier
+// read as is rather than the aligned block around it, so that a miss never reads more than what's asked for, and a
+// read hits if it's within a line. Lines are replaced in CLOCK order, and dropped when the storage under them changes
+#include <string.h>
+#include "store.h"
+
+typedef struct {
+    uint32_t addr;
+    // 0 if the line is unused
+    uint8_t len;
+    uint8_t ref;
+    uint8_t data[STORE_CACHE_LINE_SIZE];
+} cache_line_t;
+
+static cache_line_t lines[STORE_CACHE_LINES];
+static uint8_t hand = 0;
+store_cache_stats_t store_cache_stats;
+
+void store_read(const uint32_t offset, uint8_t *const buf, const uint8_t len) {
+    for (uint8_t i = 0; i < STORE_CACHE_LINES; i ++) {
+        cache_line_t *const line = &lines[i];
+        if (line->len && offset >= line->addr && offset + len <= line->addr + line->len) {
+            memcpy(buf, line->data + (offset - line->addr), len);
+            line->ref = 1;
+            store_cache_stats.hits ++;
+            return;
+        }
+    }
+    store_cache_stats.misses ++;
+    store_read_uncached(offset, buf, len);
+    if (len > STORE_CACHE_LINE_SIZE) {
+        return;
+    }
+    while (lines[hand].ref) {
+        lines[hand].ref = 0;
+        hand = (hand + 1) % STORE_CACHE_LINES;
+    }
+    cache_line_t *const line = &lines[hand];
+    hand = (hand + 1) % STORE_CACHE_LINES;
+    line->addr = offset;
+    line->len = len;
+    line->ref = 1;
+    memcpy(line->data, buf, len);
+}
+
+void store_cache_invalidate(const uint32_t offset, const uint32_t len) {
+    for (uint8_t i = 0; i < STORE_CACHE_LINES; i ++) {
+        cache_line_t *const line = &lines[i];
+        if (line->len && offset < line->addr + line->len && line->addr < offset + len) {
+            line->len = 0;
+            line->ref = 0;
+        }
+    }
+}
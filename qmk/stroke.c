@@ -7,7 +7,11 @@
 
 #include "store.h"
 
-uint8_t kvpair_buf[128];
+uint8_t kvpair_buf[STROKE_SIZE * MAX_STROKE_NUM + ENTRY_WINDOW];
+uint32_t found_bucket_addr;
+#ifdef STENO_PROFILE
+suffix_filter_stats_t suffix_filter_stats;
+#endif
 
 void hash_stroke_ptr(uint32_t *hash, const uint8_t *stroke) {
     *hash *= FNV_FACTOR;
@@ -65,63 +69,182 @@ bool stroke_to_string(uint32_t stroke, char *buf, uint8_t *ret_len) {
     return false;
 }
 
+// Strokes are hashed from the last one backwards, so that the hash of a longer candidate in `search_entry` extends
+// the hash of the shorter one
+uint32_t hash_strokes(const uint8_t *strokes, const uint8_t len) {
+    uint32_t hash = FNV_SEED;
+    for (int8_t i = len - 1; i >= 0; i --) {
+        hash_stroke_ptr(&hash, strokes + STROKE_SIZE * i);
+    }
+    return hash;
+}
+
+// `half` is either the entries or the prefixes half of a filter block
+static bool suffix_filter_has(const uint8_t *const half, const uint32_t hash) {
+    for (uint8_t i = 0; i < SUFFIX_FILTER_HASH_NUM; i ++) {
+        const uint8_t bit = (hash >> (SUFFIX_FILTER_BIT_SHIFT * i)) & (SUFFIX_FILTER_HALF_SIZE * 8 - 1);
+        if (half[bit >> 3] & (1 << (bit & 7))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void suffix_filter_set(const uint8_t *strokes, const uint8_t len, const uint8_t half_offset) {
+    uint8_t half[SUFFIX_FILTER_HALF_SIZE];
+    const uint32_t half_addr =
+        SUFFIX_FILTER_BLOCK_ADDR(hash_strokes(strokes + STROKE_SIZE * (len - 2), 2)) + half_offset;
+    const uint32_t hash = hash_strokes(strokes, len);
+    store_read(half_addr, half, SUFFIX_FILTER_HALF_SIZE);
+    for (uint8_t i = 0; i < SUFFIX_FILTER_HASH_NUM; i ++) {
+        const uint8_t bit = (hash >> (SUFFIX_FILTER_BIT_SHIFT * i)) & (SUFFIX_FILTER_HALF_SIZE * 8 - 1);
+        half[bit >> 3] &= ~(1 << (bit & 7));
+    }
+    store_write_direct(half_addr, half, SUFFIX_FILTER_HALF_SIZE);
+}
+
+void suffix_filter_add(const uint8_t *strokes, const uint8_t len) {
+    if (len < 2) {
+        return;
+    }
+    suffix_filter_set(strokes, len, 0);
+    for (uint8_t i = 2; i < len; i ++) {
+        suffix_filter_set(strokes, i, SUFFIX_FILTER_HALF_SIZE);
+    }
+}
+
+// Lengths of the entries ending in the stroke, with bit `n - 1` set for `n` strokes, `ENDING_LENS_PREFIX_BIT` set if
+// the stroke starts a longer entry, and `ENDING_LENS_MIDDLE_BIT` if it's in the middle of one
+static uint16_t ending_lens(const uint8_t *const stroke) {
+    uint16_t lens;
+    store_read(ENDING_LENS_ADDR(hash_strokes(stroke, 1)), (uint8_t *) &lens, ENDING_LENS_SIZE);
+    return ~lens;
+}
+
+void ending_lens_add(const uint8_t *strokes, const uint8_t len) {
+    uint16_t lens = ~(1 << (len - 1));
+    store_write_direct(ENDING_LENS_ADDR(hash_strokes(strokes + STROKE_SIZE * (len - 1), 1)), (const uint8_t *) &lens,
+                       ENDING_LENS_SIZE);
+    if (len > 1) {
+        lens = 0xFFFF ^ (1 << ENDING_LENS_PREFIX_BIT);
+        store_write_direct(ENDING_LENS_ADDR(hash_strokes(strokes, 1)), (const uint8_t *) &lens, ENDING_LENS_SIZE);
+    }
+    lens = 0xFFFF ^ (1 << ENDING_LENS_MIDDLE_BIT);
+    for (uint8_t i = 1; i + 1 < len; i ++) {
+        store_write_direct(ENDING_LENS_ADDR(hash_strokes(strokes + STROKE_SIZE * i, 1)), (const uint8_t *) &lens,
+                           ENDING_LENS_SIZE);
+    }
+}
+
 uint32_t find_strokes(const uint8_t *strokes, const uint8_t len, const uint8_t free) {
+    return find_strokes_hash(strokes, len, hash_strokes(strokes, len), free);
+}
+
+// Returns the bucket of the strokes, or 0 if it's not in the dictionary, keeping where it was found in
+// `found_bucket_addr`. With `free`, returns the address of the first
+// free bucket for the strokes instead (or -1 if there's none close enough), raising the displacements of the buckets in
+// between so that the searches for the strokes don't stop before it.
+uint32_t find_strokes_hash(const uint8_t *strokes, const uint8_t len, const uint32_t hash, const uint8_t free) {
+    const uint32_t home = BUCKET_SIZE * (hash & (BUCKET_NUM - 1));
+    uint32_t bucket_ind = BUCKET_START + home;
+    const uint32_t bucket_end = BUCKET_START + BUCKET_SIZE * BUCKET_NUM;
+    const uint16_t fingerprint = hash >> 20;
 #ifdef STENO_DEBUG_STROKE
     steno_debug("  find_strokes(%u):\n    ", free);
-#endif
-    uint32_t hash = FNV_SEED;
     for (uint8_t i = 0; i < len; i ++) {
-#ifdef STENO_DEBUG_STROKE
         steno_debug("%02X%02X%02X, ", strokes[STROKE_SIZE * i + 2], strokes[STROKE_SIZE * i + 1], strokes[STROKE_SIZE * i]);
-#endif
-        hash_stroke_ptr(&hash, strokes + STROKE_SIZE * i);
     }
-    uint32_t bucket_ind = BUCKET_SIZE * (hash & 0xFFFFF);   // Lower 20 bits, mul 4 to byte address
-#ifdef STENO_DEBUG_STROKE
     steno_debug_ln("");
     steno_debug_ln("    hash: %08lX, bucket_ind: %06lX", hash, bucket_ind);
 #endif
-    uint32_t bucket;
-    for (; ; bucket_ind += BUCKET_SIZE) {
-        store_read(bucket_ind, (uint8_t *) &bucket, BUCKET_SIZE);
+    uint8_t buf[BUCKET_SIZE];
+    uint16_t tails[MAX_COLLISIONS];
+    // The buckets are read in one go, only stopping for a value block or wrapping around
+    bool reading = false;
+    for (uint8_t i = 0; i <= MAX_COLLISIONS; i ++) {
+        if (!reading) {
+            store_read_begin(bucket_ind);
+            reading = true;
+        }
+        store_read_next(buf, BUCKET_SIZE);
+        uint32_t bucket;
+        uint16_t tail;
+        memcpy(&bucket, buf, 4);
+        memcpy(&tail, buf + 4, 2);
 #ifdef STENO_DEBUG_STROKE
-        steno_debug_ln("    bucket: %08lX", bucket);
+        steno_debug_ln("    bucket: %08lX %04X", bucket, tail);
 #endif
         if (free) {
             if (bucket == 0xFFFFFFFF) {
+                store_read_end();
+                for (uint8_t j = 0; j < i; j ++) {
+                    if (BUCKET_GET_DISPLACEMENT(tails[j]) < i) {
+                        // Clears the bits of `i` in the inverted displacement
+                        const uint16_t raised = tails[j] & ~(uint16_t) i;
+                        const uint32_t addr = BUCKET_START + (home + BUCKET_SIZE * j) % (BUCKET_SIZE * BUCKET_NUM);
+                        store_write_direct(addr + 4, (const uint8_t *) &raised, 2);
+                    }
+                }
                 return bucket_ind;
-            } else {
-                continue;
             }
-        }
-        const uint8_t entry_stroke_len = BUCKET_GET_STROKES_LEN(bucket);
-        if (entry_stroke_len == 0 || entry_stroke_len == 0xF) {
-            return 0;
-        }
-        if (entry_stroke_len != len) {
-            continue;
-        }
-        const uint8_t byte_len = STROKE_SIZE * len;
-        const uint32_t byte_ptr = BUCKET_GET_ADDR(bucket);
-        store_read(byte_ptr, kvpair_buf, byte_len);
+            if (i < MAX_COLLISIONS) {
+                // Inline buckets keep their displacement (read as 15 here, so never raised), and don't stop searches anyway
+                tails[i] = BUCKET_IS_INLINE(bucket) ? 0 : tail;
+            }
+        } else if (BUCKET_IS_INLINE(bucket)) {
+            // The stroke is only told apart by the hash, so it has to be from the same bucket
+            if (len == 1 && BUCKET_GET_FINGERPRINT(tail) == fingerprint && BUCKET_GET_DISPLACEMENT(tail) == i) {
+                store_read_end();
+                found_bucket_addr = bucket_ind;
+                return bucket;
+            }
+        } else {
+            const uint8_t entry_stroke_len = BUCKET_GET_STROKES_LEN(bucket);
+            if (entry_stroke_len == 0xF || BUCKET_GET_DISPLACEMENT(tail) < i) {
+                store_read_end();
+                return 0;
+            }
+            // Removed entries have a stroke count of 0
+            if (entry_stroke_len == len && BUCKET_GET_FINGERPRINT(tail) == fingerprint) {
+                // The fingerprint almost always means it's the right one, so the first window of the entry is read
+                // together with the strokes
+                const uint8_t byte_len = STROKE_SIZE * len;
+                const uint8_t entry_len = BUCKET_GET_ENTRY_LEN(bucket);
+                store_read_end();
+                reading = false;
+                store_read(BUCKET_GET_ADDR(bucket), kvpair_buf,
+                    byte_len + (entry_len < ENTRY_WINDOW ? entry_len + 1 : ENTRY_WINDOW));
 #ifdef STENO_DEBUG_STROKE
-        steno_debug("      strokes: ");
-        for (uint8_t i = 0; i < len; i ++) {
-            steno_debug("%02X%02X%02X, ", kvpair_buf[STROKE_SIZE * i + 2], kvpair_buf[STROKE_SIZE * i + 1], kvpair_buf[STROKE_SIZE * i]);
-        }
-        steno_debug_ln("");
+                steno_debug("      strokes: ");
+                for (uint8_t j = 0; j < len; j ++) {
+                    steno_debug("%02X%02X%02X, ", kvpair_buf[STROKE_SIZE * j + 2], kvpair_buf[STROKE_SIZE * j + 1], kvpair_buf[STROKE_SIZE * j]);
+                }
+                steno_debug_ln("");
 #endif
-        if (memcmp(strokes, kvpair_buf, byte_len) == 0) {
-            const uint8_t entry_len = BUCKET_GET_ENTRY_LEN(bucket);
-            store_read(byte_ptr + byte_len, kvpair_buf + byte_len, entry_len + 1);
-            return bucket;
-        } else {
-            continue;
+                if (memcmp(strokes, kvpair_buf, byte_len) == 0) {
+                    found_bucket_addr = bucket_ind;
+                    return bucket;
+                }
+            }
         }
+        bucket_ind += BUCKET_SIZE;
+        if (bucket_ind == bucket_end) {
+            bucket_ind = BUCKET_START;
+            if (reading) {
+                store_read_end();
+                reading = false;
+            }
+        }
+    }
+    if (reading) {
+        store_read_end();
     }
+    return free ? (uint32_t) -1 : 0;
 }
 
 // Searches the dictionary for the appropriate entry to output, and places result in the corresponding history entry.
+// Only the candidates that extend a prefix of some entry ending at the last stroke (kept in `prefix_lens` of the
+// history) are searched, and the prefixes ending at this stroke are updated along the way.
 uint32_t search_entry(const uint8_t h_ind) {
 #ifdef STENO_DEBUG_STROKE
     steno_debug_ln("search_entry(%d):", h_ind);
@@ -134,28 +257,84 @@ uint32_t search_entry(const uint8_t h_ind) {
     } else {
         max_strokes_len = h_ind + HIST_SIZE - stroke_start_ind + 1;
     }
-    uint32_t max_bucket = 0;
-    uint8_t strokes[STROKE_SIZE * max_strokes_len];
-    for (uint8_t i = 0; i < max_strokes_len; i ++) {
-        history_t const *old_hist = hist_get(HIST_LIMIT(h_ind - i));
-        const uint8_t strokes_len = BUCKET_GET_STROKES_LEN(old_hist->bucket);
+    history_t *const hist = hist_get(h_ind);
+    const uint32_t last_stroke = hist->stroke;
+    const uint16_t lens = ending_lens((const uint8_t *) &last_stroke);
+    // Candidates of `n + 1` strokes, for the prefixes of `n` strokes ending at the last stroke
+    const uint16_t extends = max_strokes_len > 1 ? hist_get(HIST_LIMIT(h_ind - 1))->prefix_lens << 1 : 0;
+    hist->prefix_lens = (lens >> ENDING_LENS_PREFIX_BIT) & 1;
 #ifdef STENO_DEBUG_STROKE
-        steno_debug_ln("  hist[%d].strokes_len = %d", HIST_LIMIT(h_ind - i), strokes_len);
+    steno_debug_ln("  ending lens: %04X, extends: %04X", lens, extends);
 #endif
+    uint8_t reach = 1;
+    while (extends >> reach) {
+        reach ++;
+    }
+    if (reach < max_strokes_len) {
+        max_strokes_len = reach;
+    }
+    uint8_t strokes[STROKE_SIZE * max_strokes_len];
+    uint32_t hashes[max_strokes_len];
+    uint32_t hash = FNV_SEED;
+    // Candidates that would split a multi-stroke entry in the history are not searched
+    uint16_t splits = 0;
+    uint8_t skip = 0;
+    uint8_t len = 0;
+    for (; len < max_strokes_len; len ++) {
+        history_t const *old_hist = hist_get(HIST_LIMIT(h_ind - len));
         const uint32_t stroke = old_hist->stroke;
 #ifdef STENO_DEBUG_STROKE
-        steno_debug_ln("  [%d] = %06lX", i, stroke);
+        steno_debug_ln("  [%d] = %06lX, strokes_len = %d", len, stroke, BUCKET_GET_STROKES_LEN(old_hist->bucket));
 #endif
         if (stroke == 0) {
             break;
         }
-        uint8_t *strokes_start = &strokes[STROKE_SIZE * (max_strokes_len - 1 - i)];
-        memcpy(strokes_start, &stroke, STROKE_SIZE);
-        if (i > 0 && strokes_len > 1) {
-            i += strokes_len - 2;
+        memcpy(&strokes[STROKE_SIZE * (max_strokes_len - 1 - len)], &stroke, STROKE_SIZE);
+        hash_stroke_ptr(&hash, &strokes[STROKE_SIZE * (max_strokes_len - 1 - len)]);
+        hashes[len] = hash;
+        if (skip > 0) {
+            skip --;
+            splits |= 1 << len;
+        } else if (len > 0 && BUCKET_GET_STROKES_LEN(old_hist->bucket) > 1) {
+            skip = BUCKET_GET_STROKES_LEN(old_hist->bucket) - 2;
+            splits |= 1 << len;
+        }
+    }
+
+    // Lengths to look up in the dictionary, and the number of them longer than a stroke
+    const uint16_t found = (lens & 1) | (lens & extends & ~splits & (((uint32_t) 1 << len) - 1));
+    uint8_t long_found = 0;
+    for (uint8_t i = 1; i < len; i ++) {
+        long_found += (found >> i) & 1;
+    }
+    // Reading the filter only pays for itself if it saves more than one bucket lookup. Without it, the prefixes
+    // are only narrowed down by whether the stroke is in the middle of any entry
+    uint8_t filter_block[SUFFIX_FILTER_BLOCK_SIZE];
+    const bool use_filter = long_found > 1;
+    if (use_filter) {
+        store_read(SUFFIX_FILTER_BLOCK_ADDR(hashes[1]), filter_block, SUFFIX_FILTER_BLOCK_SIZE);
+#ifdef STENO_PROFILE
+        suffix_filter_stats.reads ++;
+#endif
+    }
+    const uint16_t prefixes = (lens >> ENDING_LENS_MIDDLE_BIT) & 1 ? extends & (((uint32_t) 1 << len) - 1) : 0;
+
+    uint32_t max_bucket = 0;
+    for (uint8_t i = 0; i < len; i ++) {
+        if ((prefixes & (1 << i)) && (!use_filter || suffix_filter_has(filter_block + SUFFIX_FILTER_HALF_SIZE, hashes[i]))) {
+            hist->prefix_lens |= 1 << i;
+        }
+        if (!(found & (1 << i))) {
+            continue;
+        }
+        if (i > 0 && use_filter && !suffix_filter_has(filter_block, hashes[i])) {
+#ifdef STENO_PROFILE
+            suffix_filter_stats.skipped ++;
+#endif
             continue;
         }
-        const uint32_t bucket = find_strokes(strokes_start, i + 1, 0);
+        const uint32_t bucket =
+            find_strokes_hash(&strokes[STROKE_SIZE * (max_strokes_len - 1 - i)], i + 1, hashes[i], 0);
         if (bucket != 0) {
             max_bucket = bucket;
 #ifdef STENO_DEBUG_STROKE
@@ -166,11 +345,63 @@ uint32_t search_entry(const uint8_t h_ind) {
     return max_bucket;
 }
 
-void read_entry(const uint32_t bucket, uint8_t *const buf) {
-    const uint32_t byte_ptr = BUCKET_GET_ADDR(bucket);
+// Reads the next window of the entry
+static void entry_fill(entry_cursor_t *const cur) {
+    cur->len = cur->left < ENTRY_WINDOW ? cur->left : ENTRY_WINDOW;
+    store_read(cur->addr, cur->buf, cur->len);
+    cur->addr += cur->len;
+    cur->left -= cur->len;
+    cur->pos = 0;
+}
+
+uint8_t entry_open(entry_cursor_t *const cur, const uint32_t bucket) {
     const uint8_t entry_len = BUCKET_GET_ENTRY_LEN(bucket);
-    const uint8_t strokes_len = BUCKET_GET_STROKES_LEN(bucket);
-    store_read(byte_ptr, buf, strokes_len * STROKE_SIZE + 1 + entry_len);
+    if (BUCKET_IS_INLINE(bucket)) {
+        // Their attributes don't have room for the plain text bit, so it's found here
+        uint8_t attr = BUCKET_INLINE_ATTR(bucket) | ATTR_TEXT;
+        for (uint8_t i = 0; i < BUCKET_INLINE_SIZE; i ++) {
+            cur->buf[1 + i] = BUCKET_INLINE_BYTE(bucket, i);
+            if (i < entry_len && (cur->buf[1 + i] < 32 || cur->buf[1 + i] == 127)) {
+                attr &= ~ATTR_TEXT;
+            }
+        }
+        cur->buf[0] = attr;
+        cur->len = 1 + entry_len;
+        cur->left = 0;
+    } else {
+        cur->addr = BUCKET_GET_ENTRY_PTR(bucket) - 1;
+        cur->left = 1 + entry_len;
+        entry_fill(cur);
+    }
+    cur->pos = 1;
+    return cur->buf[0];
+}
+
+uint8_t entry_next(entry_cursor_t *const cur) {
+    if (cur->pos == cur->len) {
+        if (!cur->left) {
+            return 0;
+        }
+        entry_fill(cur);
+    }
+    return cur->buf[cur->pos ++];
+}
+
+uint8_t entry_next_run(entry_cursor_t *const cur, const uint8_t **const run, const uint8_t max) {
+    if (cur->pos == cur->len) {
+        if (!cur->left) {
+            return 0;
+        }
+        entry_fill(cur);
+    }
+    *run = cur->buf + cur->pos;
+    const uint8_t len = cur->len - cur->pos < max ? cur->len - cur->pos : max;
+    cur->pos += len;
+    return len;
+}
+
+const uint8_t *entry_whole(const entry_cursor_t *const cur) {
+    return cur->left == 0 && cur->pos == 1 ? cur->buf + 1 : NULL;
 }
 
 void print_strokes(const uint8_t *strokes, const uint8_t len) {
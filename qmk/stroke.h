@@ -3,29 +3,73 @@
 #include <stdbool.h>
 #include "steno.h"
 
+// Furthest an entry can be from the bucket its hash points to
 #define MAX_COLLISIONS 8
 #define SEARCH_NODES_SIZE 8
 #define FNV_SEED 0x811c9dc5
 #define FNV_FACTOR 0x01000193
 
 #define STROKE_SIZE 3
-#define BUCKET_SIZE 4
+#define BUCKET_SIZE 6
+#define BUCKET_NUM 0x80000
 #define MAX_STROKE_NUM 14
 #define U24_FROM_PTR_LE(p) (((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[0]))
 #define STROKE_FROM_PTR(p) U24_FROM_PTR_LE(p)
 
 #define BUCKET_START 0
 #define KVPAIR_BLOCK_START  0x400000
+#define SUFFIX_FILTER_START 0xE00000
+#define ENDING_LENS_START 0xE80000
+#define WORDS_START         0xEA0000
 #define FREEMAP_START       0xF00000
 #define SCRATCH_START       0xF22000
 #define ORTHOGRAPHY_START   0xF30000
 #define FLOG_START          0xF80000
 #define STORE_END          0x1000000
 
-#define BUCKET_GET_ENTRY_LEN(e) ((e >> 24) & 0xFF)
+// Single stroke entries of up to 3 7-bit bytes are kept in the bucket itself, marked by the top nibble of the block
+// offset. The other 24 bits are the attributes in the lowest 3, then the bytes 7 bits each, padded with zeros.
+#define BUCKET_IS_INLINE(e) (((e) & 0xF0000F) == 0xF00001)
+#define BUCKET_INLINE_PAYLOAD(e) ((((e) >> 4) & 0xFFFF) | (((e) >> 24) << 16))
+#define BUCKET_INLINE_ATTR(e) (BUCKET_INLINE_PAYLOAD(e) & 0x07)
+#define BUCKET_INLINE_BYTE(e, i) ((BUCKET_INLINE_PAYLOAD(e) >> (3 + 7 * (i))) & 0x7F)
+#define BUCKET_INLINE_LEN(e) ((BUCKET_INLINE_BYTE(e, 0) != 0) + (BUCKET_INLINE_BYTE(e, 1) != 0) + (BUCKET_INLINE_BYTE(e, 2) != 0))
+#define BUCKET_INLINE_SIZE 3
+
+#define BUCKET_GET_ENTRY_LEN(e) (BUCKET_IS_INLINE(e) ? BUCKET_INLINE_LEN(e) : ((e) >> 24) & 0xFF)
 #define BUCKET_GET_STROKES_LEN(e) (e & 0x0F)
 #define BUCKET_GET_ADDR(e) ((e & 0xFFFFF0) + KVPAIR_BLOCK_START)
 #define BUCKET_GET_ENTRY_PTR(e) (BUCKET_GET_ADDR(e) + STROKE_SIZE * BUCKET_GET_STROKES_LEN(e) + 1)
+// The last 2 bytes of a bucket are the upper 12 bits of the hash, to tell the buckets of other strokes apart without
+// reading the value block, and the displacement from the bucket the hash points to. The displacement is inverted so
+// that it can only be raised without erasing, and a search stops at a bucket displaced less than it would be. Inline
+// buckets are only told apart by the displacement and fingerprint, so theirs are never raised, and they don't stop
+// searches.
+#define BUCKET_TAIL(hash, displacement) ((uint16_t) ((hash) >> 20 << 4 | (0xF ^ (displacement))))
+#define BUCKET_GET_FINGERPRINT(t) ((t) >> 4)
+#define BUCKET_GET_DISPLACEMENT(t) (0xF ^ ((t) & 0xF))
+
+// Blocked bloom filter over the entries with more than one stroke and their proper prefixes, with the block picked by
+// the hash of the last two strokes. The first half of a block is for the entries, and the second half for the prefixes;
+// bits are cleared for the sequences present
+#define SUFFIX_FILTER_BLOCK_SIZE 32
+#define SUFFIX_FILTER_HALF_SIZE 16
+#define SUFFIX_FILTER_BLOCK_NUM 0x4000
+#define SUFFIX_FILTER_BLOCK_SHIFT 18
+#define SUFFIX_FILTER_HASH_NUM 3
+#define SUFFIX_FILTER_BIT_SHIFT 7
+#define SUFFIX_FILTER_BLOCK_ADDR(hash_2) \
+    (SUFFIX_FILTER_START + SUFFIX_FILTER_BLOCK_SIZE * (((hash_2) >> SUFFIX_FILTER_BLOCK_SHIFT) & (SUFFIX_FILTER_BLOCK_NUM - 1)))
+
+// The stroke counts of the entries ending in a stroke, indexed by the upper bits of the hash of that stroke. Bit
+// `n - 1` is cleared if there is an entry of `n` strokes, `ENDING_LENS_PREFIX_BIT` if the stroke starts an entry of
+// more strokes, and `ENDING_LENS_MIDDLE_BIT` if it's neither the first nor the last stroke of one, so that entries can
+// be added with a direct write
+#define ENDING_LENS_SIZE 2
+#define ENDING_LENS_NUM 0x10000
+#define ENDING_LENS_MIDDLE_BIT 14
+#define ENDING_LENS_PREFIX_BIT 15
+#define ENDING_LENS_ADDR(hash_1) (ENDING_LENS_START + ENDING_LENS_SIZE * ((hash_1) >> 16))
 
 #define FREEMAP_LVL_0 FREEMAP_START
 #define FREEMAP_LVL_1 ((1ul << 20) / 32 * 4 + FREEMAP_LVL_0)
@@ -48,7 +92,11 @@ typedef struct __attribute__((packed)) {
     uint8_t space_prev : 1;
     uint8_t space_after : 1;
     uint8_t glue : 1;
+    uint8_t present : 1;
+    // Only printable ASCII, without any commands
+    uint8_t text : 1;
 } attr_t;
+#define ATTR_TEXT 0x10
 
 typedef struct __attribute__((packed)) {
     uint8_t letter : 5;
@@ -71,13 +119,48 @@ typedef struct __attribute__((packed)) {
     char extra_text[8];
 } orthography_entry_t;
 
-extern uint8_t kvpair_buf[128];
+// Entries are read a window at a time, starting with the attribute byte, so that the output can go out as it's read
+#define ENTRY_WINDOW 16
+
+// Reader of an entry, from the storage or from the bucket itself for inline entries
+typedef struct {
+    uint32_t addr;      // Of the bytes after the window
+    uint16_t left;      // Bytes of the entry after the window
+    uint8_t pos;        // Of the next byte in the window
+    uint8_t len;
+    uint8_t buf[ENTRY_WINDOW];
+} entry_cursor_t;
+
+// The strokes of the entry last looked up, followed by its attribute byte and the start of the entry, as far as the
+// first window of the entry goes
+extern uint8_t kvpair_buf[STROKE_SIZE * MAX_STROKE_NUM + ENTRY_WINDOW];
+extern uint32_t found_bucket_addr;
 
 bool stroke_to_string(const uint32_t stroke, char *buf, uint8_t *len);
 uint32_t qmk_chord_to_stroke(const uint8_t chord[6]);
 uint8_t last_entry_len(void);
+uint32_t hash_strokes(const uint8_t *strokes, const uint8_t len);
 uint32_t find_strokes(const uint8_t *strokes, const uint8_t len, const uint8_t free);
+uint32_t find_strokes_hash(const uint8_t *strokes, const uint8_t len, const uint32_t hash, const uint8_t free);
+void suffix_filter_add(const uint8_t *strokes, const uint8_t len);
+void ending_lens_add(const uint8_t *strokes, const uint8_t len);
 uint32_t search_entry(const uint8_t h_ind);
+#ifdef STENO_PROFILE
+typedef struct {
+    // Filter blocks read by `search_entry`
+    uint32_t reads;
+    // Candidates of more than a stroke that would have been searched for without the filter
+    uint32_t skipped;
+} suffix_filter_stats_t;
+extern suffix_filter_stats_t suffix_filter_stats;
+#endif
 uint32_t freemap_req(const uint8_t block);
 void print_strokes(const uint8_t *strokes, const uint8_t len);
-void read_entry(const uint32_t bucket, uint8_t *buf);
+// Starts reading the entry of `bucket`; its attribute byte
+uint8_t entry_open(entry_cursor_t *cur, const uint32_t bucket);
+// The next byte of the entry, or 0 past its end
+uint8_t entry_next(entry_cursor_t *cur);
+// Points `run` to the next bytes of the entry, as many as are read in already up to `max`; how many, or 0 past its end
+uint8_t entry_next_run(entry_cursor_t *cur, const uint8_t **run, uint8_t max);
+// The entry as a whole, if it fits in the window and nothing's read of it yet; NULL otherwise
+const uint8_t *entry_whole(const entry_cursor_t *cur);